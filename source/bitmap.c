@@ -0,0 +1,392 @@
+/*
+  Compressed bitmaps of node sets, in the style of Roaring bitmaps: the
+  nodes are grouped by their high 16 bits into containers, each holding
+  the low 16 bits of its nodes either as a sorted array (up to 4096
+  values) or as a bitmap of 2^16 bits (8 KB), whichever is smaller. Sparse
+  and dense sets both stay compact, and unions and intersections work
+  container by container.
+*/
+
+#define BITMAP_ARRAY_MAX 4096 // max values of an array container
+#define BITMAP_WORDS 1024     // words of a bitmap container
+
+typedef struct _Container {
+  uint16_t key;           // high 16 bits of the values
+  uint32_t cardinality;   // number of values
+  uint16_t *values;       // sorted low 16 bits (array container), or NULL
+  uint64_t *words;        // bits of the low 16 bits (bitmap container), or NULL
+} Container;
+
+typedef struct _Bitmap {
+  int size;               // number of containers
+  Container *containers;  // non-empty containers, by increasing key
+} Bitmap;
+
+typedef struct _ContainerHeader {
+  uint16_t key;
+  uint16_t bitmap;        // whether the container is a bitmap
+  uint32_t cardinality;
+} ContainerHeader;
+
+Bitmap *bitmap_new(int size) {
+  Bitmap *b = (Bitmap *) malloc(sizeof(Bitmap));
+  assert(b != NULL);
+  b->size = 0;
+  b->containers = (Container *) malloc((size > 0 ? size : 1) * sizeof(Container));
+  assert(b->containers != NULL);
+  return b;
+}
+
+static void container_clean(Container *c) {
+  free(c->values);
+  free(c->words);
+  c->values = NULL;
+  c->words = NULL;
+}
+
+void bitmap_destroy(Bitmap *b) {
+  int k;
+  for (k = 0; k < b->size; k++)
+    container_clean(b->containers + k);
+  free(b->containers);
+  free(b);
+}
+
+long bitmap_cardinality(Bitmap *b) {
+  long n = 0;
+  int k;
+  for (k = 0; k < b->size; k++)
+    n += b->containers[k].cardinality;
+  return n;
+}
+
+/**
+   Stores the values of a bitmap container into an array container if it
+   has few enough of them
+*/
+static void container_shrink(Container *c) {
+  int w, n = 0;
+  uint64_t bits;
+  if (c->words == NULL || c->cardinality > BITMAP_ARRAY_MAX)
+    return;
+  c->values = (uint16_t *) malloc((c->cardinality > 0 ? c->cardinality : 1) * sizeof(uint16_t));
+  assert(c->values != NULL);
+  for (w = 0; w < BITMAP_WORDS; w++)
+    for (bits = c->words[w]; bits; bits &= bits - 1)
+      c->values[n++] = (w << 6) | __builtin_ctzll(bits);
+  free(c->words);
+  c->words = NULL;
+}
+
+/**
+   Bitmap of the nodes of a list, in any order; duplicates are counted once
+*/
+Bitmap *bitmap_from_nodes(const int *nodes, long n) {
+  long i, *start;
+  int k, keys = 0, max = 0, w;
+  uint16_t *low;
+  Bitmap *b;
+  Container *c;
+  for (i = 0; i < n; i++)
+    if (nodes[i] > max)
+      max = nodes[i];
+  // counting sort of the low bits by high bits
+  keys = (max >> 16) + 1;
+  start = (long *) calloc(keys + 1, sizeof(long));
+  low = (uint16_t *) malloc((n > 0 ? n : 1) * sizeof(uint16_t));
+  assert(start != NULL && low != NULL);
+  for (i = 0; i < n; i++)
+    start[(nodes[i] >> 16) + 1]++;
+  for (k = 0; k < keys; k++)
+    start[k+1] += start[k];
+  for (i = 0; i < n; i++)
+    low[start[nodes[i] >> 16]++] = nodes[i] & 0xffff;
+  for (k = keys; k > 0; k--)
+    start[k] = start[k-1];
+  start[0] = 0;
+
+  for (k = 0, b = bitmap_new(0); k < keys; k++)
+    if (start[k+1] > start[k])
+      b->size++;
+  b->containers = (Container *) realloc(b->containers, (b->size > 0 ? b->size : 1) * sizeof(Container));
+  assert(b->containers != NULL);
+  for (k = 0, c = b->containers; k < keys; k++) {
+    if (start[k+1] == start[k])
+      continue;
+    c->key = k;
+    c->values = NULL;
+    c->words = (uint64_t *) calloc(BITMAP_WORDS, sizeof(uint64_t));
+    assert(c->words != NULL);
+    for (i = start[k]; i < start[k+1]; i++)
+      c->words[low[i] >> 6] |= 1ULL << (low[i] & 63);
+    for (w = 0, c->cardinality = 0; w < BITMAP_WORDS; w++)
+      c->cardinality += __builtin_popcountll(c->words[w]);
+    container_shrink(c);
+    c++;
+  }
+  free(low);
+  free(start);
+  return b;
+}
+
+/**
+   Writes the nodes of the bitmap, in increasing order, into nodes, up to
+   max of them; returns their number
+*/
+long bitmap_to_nodes(Bitmap *b, int *nodes, long max) {
+  long n = 0;
+  int k, w;
+  uint32_t i;
+  uint64_t bits;
+  Container *c;
+  for (k = 0; k < b->size; k++) {
+    c = b->containers + k;
+    if (c->words == NULL)
+      for (i = 0; i < c->cardinality && n < max; i++)
+	nodes[n++] = ((int)c->key << 16) | c->values[i];
+    else
+      for (w = 0; w < BITMAP_WORDS; w++)
+	for (bits = c->words[w]; bits && n < max; bits &= bits - 1)
+	  nodes[n++] = ((int)c->key << 16) | (w << 6) | __builtin_ctzll(bits);
+  }
+  return n;
+}
+
+/**
+   Union of the containers a and b (of the same key) into c
+*/
+static void container_or(Container *a, Container *b, Container *c) {
+  uint32_t i = 0, j = 0, n = 0;
+  int w;
+  c->key = a->key;
+  c->values = NULL;
+  c->words = NULL;
+  if (a->words == NULL && b->words == NULL && a->cardinality + b->cardinality <= BITMAP_ARRAY_MAX) {
+    c->values = (uint16_t *) malloc((a->cardinality + b->cardinality) * sizeof(uint16_t));
+    assert(c->values != NULL);
+    while (i < a->cardinality || j < b->cardinality)
+      if (j == b->cardinality || (i < a->cardinality && a->values[i] < b->values[j]))
+	c->values[n++] = a->values[i++];
+      else if (i == a->cardinality || b->values[j] < a->values[i])
+	c->values[n++] = b->values[j++];
+      else {
+	c->values[n++] = a->values[i++];
+	j++;
+      }
+    c->cardinality = n;
+    return;
+  }
+  c->words = (uint64_t *) calloc(BITMAP_WORDS, sizeof(uint64_t));
+  assert(c->words != NULL);
+  if (a->words)
+    memcpy(c->words, a->words, BITMAP_WORDS * sizeof(uint64_t));
+  else
+    for (i = 0; i < a->cardinality; i++)
+      c->words[a->values[i] >> 6] |= 1ULL << (a->values[i] & 63);
+  if (b->words)
+    for (w = 0; w < BITMAP_WORDS; w++)
+      c->words[w] |= b->words[w];
+  else
+    for (j = 0; j < b->cardinality; j++)
+      c->words[b->values[j] >> 6] |= 1ULL << (b->values[j] & 63);
+  for (w = 0, c->cardinality = 0; w < BITMAP_WORDS; w++)
+    c->cardinality += __builtin_popcountll(c->words[w]);
+}
+
+/**
+   Intersection of the containers a and b (of the same key) into c
+*/
+static void container_and(Container *a, Container *b, Container *c) {
+  uint32_t i = 0, j = 0, n = 0;
+  int w;
+  Container *x;
+  c->key = a->key;
+  c->values = NULL;
+  c->words = NULL;
+  if (a->words && b->words) {
+    c->words = (uint64_t *) malloc(BITMAP_WORDS * sizeof(uint64_t));
+    assert(c->words != NULL);
+    for (w = 0, c->cardinality = 0; w < BITMAP_WORDS; w++)
+      c->cardinality += __builtin_popcountll(c->words[w] = a->words[w] & b->words[w]);
+    container_shrink(c);
+    return;
+  }
+  if (a->words) { // the array one in a
+    x = a; a = b; b = x;
+  }
+  c->values = (uint16_t *) malloc((a->cardinality > 0 ? a->cardinality : 1) * sizeof(uint16_t));
+  assert(c->values != NULL);
+  if (b->words) {
+    for (i = 0; i < a->cardinality; i++)
+      if ((b->words[a->values[i] >> 6] >> (a->values[i] & 63)) & 1)
+	c->values[n++] = a->values[i];
+  } else
+    while (i < a->cardinality && j < b->cardinality)
+      if (a->values[i] < b->values[j])
+	i++;
+      else if (b->values[j] < a->values[i])
+	j++;
+      else {
+	c->values[n++] = a->values[i++];
+	j++;
+      }
+  c->cardinality = n;
+}
+
+static void container_copy(Container *a, Container *c) {
+  *c = *a;
+  if (a->words) {
+    c->words = (uint64_t *) malloc(BITMAP_WORDS * sizeof(uint64_t));
+    assert(c->words != NULL);
+    memcpy(c->words, a->words, BITMAP_WORDS * sizeof(uint64_t));
+  } else {
+    c->values = (uint16_t *) malloc((a->cardinality > 0 ? a->cardinality : 1) * sizeof(uint16_t));
+    assert(c->values != NULL);
+    memcpy(c->values, a->values, a->cardinality * sizeof(uint16_t));
+  }
+}
+
+Bitmap *bitmap_or(Bitmap *a, Bitmap *b) {
+  Bitmap *c = bitmap_new(a->size + b->size);
+  int i = 0, j = 0;
+  while (i < a->size || j < b->size)
+    if (j == b->size || (i < a->size && a->containers[i].key < b->containers[j].key))
+      container_copy(a->containers + i++, c->containers + c->size++);
+    else if (i == a->size || b->containers[j].key < a->containers[i].key)
+      container_copy(b->containers + j++, c->containers + c->size++);
+    else
+      container_or(a->containers + i++, b->containers + j++, c->containers + c->size++);
+  return c;
+}
+
+Bitmap *bitmap_and(Bitmap *a, Bitmap *b) {
+  Bitmap *c = bitmap_new(a->size < b->size ? a->size : b->size);
+  int i = 0, j = 0;
+  while (i < a->size && j < b->size)
+    if (a->containers[i].key < b->containers[j].key)
+      i++;
+    else if (b->containers[j].key < a->containers[i].key)
+      j++;
+    else {
+      container_and(a->containers + i++, b->containers + j++, c->containers + c->size);
+      if (c->containers[c->size].cardinality > 0)
+	c->size++;
+      else
+	container_clean(c->containers + c->size);
+    }
+  return c;
+}
+
+/**
+   Size in bytes of the serialized bitmap
+*/
+long bitmap_bytes(Bitmap *b) {
+  long bytes = sizeof(uint32_t) + b->size * sizeof(ContainerHeader);
+  int k;
+  for (k = 0; k < b->size; k++)
+    bytes += b->containers[k].words ? BITMAP_WORDS * sizeof(uint64_t)
+      : b->containers[k].cardinality * sizeof(uint16_t);
+  return bytes;
+}
+
+/**
+   Serializes the bitmap into buffer, of bitmap_bytes(b) bytes: the number
+   of containers, their headers, then their values or words
+*/
+void bitmap_serialize(Bitmap *b, char *buffer) {
+  uint32_t size = b->size;
+  ContainerHeader h;
+  int k;
+  memcpy(buffer, &size, sizeof(uint32_t));
+  buffer += sizeof(uint32_t);
+  for (k = 0; k < b->size; k++) {
+    h.key = b->containers[k].key;
+    h.bitmap = b->containers[k].words != NULL;
+    h.cardinality = b->containers[k].cardinality;
+    memcpy(buffer, &h, sizeof(ContainerHeader));
+    buffer += sizeof(ContainerHeader);
+  }
+  for (k = 0; k < b->size; k++)
+    if (b->containers[k].words) {
+      memcpy(buffer, b->containers[k].words, BITMAP_WORDS * sizeof(uint64_t));
+      buffer += BITMAP_WORDS * sizeof(uint64_t);
+    } else {
+      memcpy(buffer, b->containers[k].values, b->containers[k].cardinality * sizeof(uint16_t));
+      buffer += b->containers[k].cardinality * sizeof(uint16_t);
+    }
+}
+
+/**
+   Whether the values of container c are consistent with its cardinality
+   and all below n: strictly increasing for an array, as many bits as the
+   cardinality for a bitmap
+*/
+static int container_valid(Container *c, long n) {
+  long base = (long)c->key << 16, count = 0;
+  uint32_t i;
+  int w;
+  if (c->words == NULL) {
+    for (i = 1; i < c->cardinality; i++)
+      if (c->values[i-1] >= c->values[i])
+	return 0;
+    return c->cardinality == 0 || base + c->values[c->cardinality - 1] < n;
+  }
+  for (w = 0; w < BITMAP_WORDS; w++)
+    if (c->words[w]) {
+      count += __builtin_popcountll(c->words[w]);
+      if (base + (w << 6) + 63 - __builtin_clzll(c->words[w]) >= n)
+	return 0;
+    }
+  return count == c->cardinality;
+}
+
+/**
+   Reads a bitmap of nodes among n serialized in buffer, of the given size
+   in bytes; returns NULL if it is malformed: keys not increasing, values
+   not below n, or cardinalities that do not match the containers
+*/
+Bitmap *bitmap_deserialize(const char *buffer, long bytes, long n) {
+  const char *end = buffer + bytes, *data;
+  uint32_t size;
+  ContainerHeader h;
+  Container *c;
+  Bitmap *b;
+  long length;
+  int k;
+  if (bytes < (long)sizeof(uint32_t))
+    return NULL;
+  memcpy(&size, buffer, sizeof(uint32_t));
+  data = buffer + sizeof(uint32_t) + (long)size * sizeof(ContainerHeader);
+  if (size > (1U << 16) || data > end)
+    return NULL;
+  b = bitmap_new(size);
+  for (k = 0; k < (int)size; k++) {
+    memcpy(&h, buffer + sizeof(uint32_t) + k * sizeof(ContainerHeader), sizeof(ContainerHeader));
+    length = h.bitmap ? BITMAP_WORDS * sizeof(uint64_t) : h.cardinality * sizeof(uint16_t);
+    if (data + length > end || (!h.bitmap && h.cardinality > BITMAP_ARRAY_MAX)
+	|| (b->size > 0 && h.key <= b->containers[b->size - 1].key) || ((long)h.key << 16) >= n) {
+      bitmap_destroy(b);
+      return NULL;
+    }
+    c = b->containers + b->size++;
+    c->key = h.key;
+    c->cardinality = h.cardinality;
+    c->values = NULL;
+    c->words = NULL;
+    if (h.bitmap) {
+      c->words = (uint64_t *) malloc(length);
+      assert(c->words != NULL);
+      memcpy(c->words, data, length);
+    } else {
+      c->values = (uint16_t *) malloc(length > 0 ? length : 1);
+      assert(c->values != NULL);
+      memcpy(c->values, data, length);
+    }
+    data += length;
+    if (!container_valid(c, n)) {
+      bitmap_destroy(b);
+      return NULL;
+    }
+  }
+  return b;
+}
@@ -0,0 +1,387 @@
+/*
+  Graph downsampling: picks a set of nodes of the graph and keeps the
+  subgraph they induce, renumbered from 0 in the order of the original ids
+  (so that the adjacency lists stay sorted), with the map back to them.
+
+  The nodes are picked by one of three samplers, all driven by the hash of
+  (seed, node) rather than by the order in which threads reach the nodes,
+  so that a sample depends on the seed only:
+  - forest fire (Leskovec and Faloutsos): a fire started at a random node
+    burns, from each burning node, a geometric number of its neighbors
+    (mean p / (1 - p) for the burning probability p), then the nodes they
+    reach, and so on; when it dies out, a new fire starts elsewhere;
+  - snowball: breadth-first from a random node, each node adding up to k
+    of its neighbors (all of them if k = 0), restarting elsewhere when the
+    component is exhausted;
+  - induced edge sampling (TIES): the links are taken in a random order and
+    their ends kept until there are enough nodes, which keeps the degree
+    distribution far better than picking the nodes themselves; every link
+    between kept nodes is then added back.
+  Fires and snowballs spread level by level, every level by all threads,
+  which claim nodes by compare-and-swap as the epidemics' thread team does
+  (see epidemic_spread_team); a node burns the first neighbors of its list
+  from a random offset, counting those burned earlier in the same level by
+  other nodes, and skipping those of earlier levels, so that the set of
+  nodes of every level does not depend on the threads. The last level is
+  cut to the nodes of smallest hash. The graph must be clean (sorted
+  adjacency lists without self-loops or duplicates, see graph_clean).
+*/
+
+#define DOWNSAMPLE_CHUNK 256      // nodes of a level burned by a thread at a time
+#define DOWNSAMPLE_WEDGES 100000   // wedges drawn to estimate the clustering
+#define DOWNSAMPLE_BINS 32         // degree histogram bins: degrees in [2^b, 2^(b+1))
+#define DOWNSAMPLE_SELECT_BITS 16  // top key bits of the selection histogram
+
+typedef enum _Sampler {SamplerForestFire, SamplerSnowball, SamplerInduced} Sampler;
+
+typedef struct _GraphProfile {
+  int n;                  // nodes
+  long m;                 // links
+  int max_degree;         // largest degree
+  double clustering;      // average local clustering of the nodes of degree 2 or more, estimated
+  long degrees[DOWNSAMPLE_BINS]; // nodes by degree: 0, 1, 2-3, 4-7, ...
+} GraphProfile;
+
+/**
+   Symmetric hash of the link u - v
+*/
+static inline uint64_t downsample_link_key(uint64_t seed, int u, int v) {
+  return u < v ? rng_hash(seed, ((uint64_t)(uint32_t)u << 32) | (uint32_t)v)
+    : rng_hash(seed, ((uint64_t)(uint32_t)v << 32) | (uint32_t)u);
+}
+
+typedef struct _KeyIndex {
+  uint64_t key;
+  long i;
+} KeyIndex;
+
+static int key_index_compare(const void *a, const void *b) {
+  const KeyIndex *x = (const KeyIndex *) a, *y = (const KeyIndex *) b;
+  if (x->key != y->key)
+    return x->key < y->key ? -1 : 1;
+  return (x->i > y->i) - (x->i < y->i);
+}
+
+/**
+   Sets chosen[i] to 1 for the k smallest of the count keys (ties broken by
+   index), 0 for the others: the top bits of the keys are counted in
+   parallel, then only the keys of the bin holding the k-th one are sorted.
+*/
+void downsample_smallest(const uint64_t *keys, long count, long k, char *chosen) {
+  const int bins = 1 << DOWNSAMPLE_SELECT_BITS, shift = 64 - DOWNSAMPLE_SELECT_BITS;
+  long *hist = (long *) calloc(bins, sizeof(long)), below = 0, num_ties = 0, i;
+  KeyIndex *ties;
+  int b;
+  assert(hist != NULL);
+  if (k >= count) {
+    memset(chosen, 1, count);
+    free(hist);
+    return;
+  }
+  #pragma omp parallel
+  {
+    long *local = (long *) calloc(bins, sizeof(long)), j;
+    int c;
+    assert(local != NULL);
+    #pragma omp for
+    for (j = 0; j < count; j++)
+      local[keys[j] >> shift]++;
+    #pragma omp critical (downsample_hist)
+    for (c = 0; c < bins; c++)
+      hist[c] += local[c];
+    free(local);
+  }
+  for (b = 0; below + hist[b] < k; b++)
+    below += hist[b];
+  ties = (KeyIndex *) malloc((hist[b] > 0 ? hist[b] : 1) * sizeof(KeyIndex));
+  assert(ties != NULL);
+  #pragma omp parallel for
+  for (i = 0; i < count; i++) {
+    int c = keys[i] >> shift;
+    chosen[i] = c < b;
+    if (c == b) {
+      long at = __atomic_fetch_add(&num_ties, 1, __ATOMIC_RELAXED);
+      ties[at].key = keys[i];
+      ties[at].i = i;
+    }
+  }
+  qsort(ties, num_ties, sizeof(KeyIndex), key_index_compare);
+  for (i = 0; i < k - below; i++)
+    chosen[ties[i].i] = 1;
+  free(ties);
+  free(hist);
+}
+
+/**
+   Number of neighbors that node u burns: geometric of parameter burn for
+   a forest fire, at most limit for a snowball (all if 0)
+*/
+static inline int downsample_burns(Sampler sampler, uint64_t seed, int u, double burn, int limit) {
+  double x;
+  if (sampler == SamplerSnowball)
+    return limit > 0 ? limit : INT_MAX;
+  x = ((rng_hash(seed ^ 0x66697265ULL, u) >> 11) + 1) * (1.0 / 9007199254740992.0); // in (0, 1]
+  x = floor(log(x) / log(burn));
+  return x < INT_MAX ? (int) x : INT_MAX;
+}
+
+/**
+   Spreads a forest fire or a snowball until k nodes are burned; sets
+   kept[u] to 1 for them, 0 for the others. Returns the number of fires
+   started.
+*/
+long downsample_spread(graph *g, Sampler sampler, long k, double burn, int limit, uint64_t seed, char *kept) {
+  int *level = (int *) calloc(g->n > 0 ? g->n : 1, sizeof(int)); // level burning each node, 0 if none
+  Frontier *active = frontier_new(g->n);
+  long burned = 0, fires = 0, c, size;
+  int u, l = 0, chunks;
+  uint64_t *keys;
+  char *chosen;
+  Rng r;
+  assert(level != NULL && k <= g->n);
+  rng_seed(&r, rng_hash(seed, 0x7365656473ULL));
+
+  while (burned < k) {
+    // a new fire, from a random node not burned yet
+    do
+      u = rng_below(&r, g->n);
+    while (level[u]);
+    level[u] = ++l;
+    frontier_add(active, u);
+    frontier_swap(active);
+    burned++;
+    fires++;
+    while (!frontier_empty(active) && burned < k) {
+      l++;
+      chunks = (active->size + DOWNSAMPLE_CHUNK - 1) / DOWNSAMPLE_CHUNK;
+      #pragma omp parallel for schedule(dynamic,1)
+      for (c = 0; c < chunks; c++) {
+	FrontierBlock block;
+	int i, j, w, v, d, x, first, expected;
+	int end = (c+1)*DOWNSAMPLE_CHUNK < active->size ? (c+1)*DOWNSAMPLE_CHUNK : active->size;
+	block.size = 0;
+	for (j = c*DOWNSAMPLE_CHUNK; j < end; j++) {
+	  w = active->current[j];
+	  if ((d = g->degrees[w]) == 0)
+	    continue;
+	  x = downsample_burns(sampler, seed, w, burn, limit);
+	  first = rng_hash(seed, w) % d;
+	  for (i = 0; i < d && x > 0; i++) {
+	    v = g->links[w][first + i < d ? first + i : first + i - d];
+	    expected = 0;
+	    if (__atomic_compare_exchange_n(level + v, &expected, l, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	      frontier_add_block(active, &block, v);
+	      x--;
+	    } else if (expected == l)
+	      x--;
+	  }
+	}
+	frontier_flush(active, &block);
+      }
+      size = active->next_size;
+      if (burned + size > k) {
+	// last level: the nodes of smallest hash
+	keys = (uint64_t *) malloc(size * sizeof(uint64_t));
+	chosen = (char *) malloc(size);
+	assert(keys != NULL && chosen != NULL);
+	#pragma omp parallel for
+	for (c = 0; c < size; c++)
+	  keys[c] = rng_hash(seed ^ 0x6c617374ULL, active->next[c]);
+	downsample_smallest(keys, size, k - burned, chosen);
+	#pragma omp parallel for
+	for (c = 0; c < size; c++)
+	  if (!chosen[c])
+	    level[active->next[c]] = 0;
+	free(keys);
+	free(chosen);
+	size = k - burned;
+      }
+      burned += size;
+      frontier_swap(active);
+    }
+    active->size = 0;
+  }
+  #pragma omp parallel for
+  for (u = 0; u < g->n; u++)
+    kept[u] = level[u] != 0;
+  frontier_destroy(active);
+  free(level);
+  return fires;
+}
+
+/**
+   Induced edge sampling: sets kept[u] to 1 for the k nodes reached first
+   when the links are taken in the order of their hash, 0 for the others.
+   Nodes without links come last.
+*/
+void downsample_induced(graph *g, long k, uint64_t seed, char *kept) {
+  uint64_t *keys = (uint64_t *) malloc((g->n > 0 ? g->n : 1) * sizeof(uint64_t));
+  int u;
+  assert(keys != NULL);
+  #pragma omp parallel for schedule(dynamic,1024)
+  for (u = 0; u < g->n; u++) {
+    uint64_t key = UINT64_MAX, h;
+    int i;
+    for (i = 0; i < g->degrees[u]; i++)
+      if ((h = downsample_link_key(seed, u, g->links[u][i])) < key)
+	key = h;
+    keys[u] = key;
+  }
+  downsample_smallest(keys, g->n, k, kept);
+  free(keys);
+}
+
+/**
+   Subgraph induced by the kept nodes, renumbered in the order of their
+   ids; (*map)[u] is the original id of node u of the subgraph
+*/
+graph *downsample_induce(graph *g, const char *kept, int **map) {
+  int parts = PREPROCESS_PARTS * omp_get_max_threads(), k, u, *ids, *offset, *bounds;
+  graph *s = (graph *) malloc(sizeof(graph));
+  long arcs = 0;
+  ids = (int *) malloc((g->n > 0 ? g->n : 1) * sizeof(int)); // new id of each node, -1 if not kept
+  offset = (int *) calloc(parts + 1, sizeof(int));
+  bounds = (int *) malloc((parts + 1) * sizeof(int));
+  assert(s != NULL && ids != NULL && offset != NULL && bounds != NULL);
+  for (k = 0; k <= parts; k++)
+    bounds[k] = (long)g->n * k / parts;
+
+  // new ids: kept nodes of each range, then a prefix sum
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int v, count = 0;
+    for (v = bounds[k]; v < bounds[k+1]; v++)
+      count += kept[v];
+    offset[k+1] = count;
+  }
+  for (k = 0; k < parts; k++)
+    offset[k+1] += offset[k];
+  s->n = offset[parts];
+  s->directed = 0;
+  *map = (int *) malloc((s->n > 0 ? s->n : 1) * sizeof(int));
+  s->degrees = (int *) malloc((s->n > 0 ? s->n : 1) * sizeof(int));
+  s->capacities = (int *) malloc((s->n > 0 ? s->n : 1) * sizeof(int));
+  s->links = (int **) malloc((s->n > 0 ? s->n : 1) * sizeof(int *));
+  assert(*map != NULL && s->degrees != NULL && s->capacities != NULL && s->links != NULL);
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int v, at = offset[k];
+    for (v = bounds[k]; v < bounds[k+1]; v++)
+      if (kept[v]) {
+	(*map)[at] = v;
+	ids[v] = at++;
+      } else
+	ids[v] = -1;
+  }
+
+  // degrees, then the links of each node, in the same (sorted) order
+  #pragma omp parallel for schedule(dynamic,1024) reduction(+:arcs)
+  for (u = 0; u < s->n; u++) {
+    int i, v = (*map)[u], d = 0;
+    for (i = 0; i < g->degrees[v]; i++)
+      d += ids[g->links[v][i]] >= 0;
+    s->degrees[u] = s->capacities[u] = d;
+    arcs += d;
+  }
+  s->m = arcs / 2;
+  s->links[0] = (int *) malloc((arcs > 0 ? arcs : 1) * sizeof(int));
+  assert(s->links[0] != NULL);
+  for (u = 1; u < s->n; u++)
+    s->links[u] = s->links[u-1] + s->degrees[u-1];
+  #pragma omp parallel for schedule(dynamic,1024)
+  for (u = 0; u < s->n; u++) {
+    int i, v = (*map)[u], d = 0;
+    for (i = 0; i < g->degrees[v]; i++)
+      if (ids[g->links[v][i]] >= 0)
+	s->links[u][d++] = ids[g->links[v][i]];
+  }
+  free(ids);
+  free(offset);
+  free(bounds);
+  return s;
+}
+
+/**
+   Degree histogram and clustering of g; the clustering is the fraction of
+   closed wedges among DOWNSAMPLE_WEDGES drawn at nodes of degree 2 or more
+*/
+void downsample_profile(graph *g, uint64_t seed, GraphProfile *p) {
+  long degrees[DOWNSAMPLE_BINS], arcs = 0, wedges = 0, closed = 0;
+  int u, b, max_degree = 0;
+  memset(degrees, 0, sizeof(degrees));
+  #pragma omp parallel for reduction(+:arcs,degrees[:DOWNSAMPLE_BINS]) reduction(max:max_degree)
+  for (u = 0; u < g->n; u++) {
+    int d = g->degrees[u], c = 0;
+    while (d) {
+      d >>= 1;
+      c++;
+    }
+    degrees[c < DOWNSAMPLE_BINS ? c : DOWNSAMPLE_BINS - 1]++;
+    arcs += g->degrees[u];
+    if (g->degrees[u] > max_degree)
+      max_degree = g->degrees[u];
+  }
+  p->n = g->n;
+  p->m = arcs / 2;
+  p->max_degree = max_degree;
+  memcpy(p->degrees, degrees, sizeof(degrees));
+  p->clustering = 0;
+  if (g->n - degrees[0] - degrees[1] == 0)
+    return;
+  #pragma omp parallel for schedule(dynamic,1024) reduction(+:wedges,closed)
+  for (b = 0; b < DOWNSAMPLE_WEDGES; b++) {
+    Rng r;
+    int v, i, j, d, tries;
+    rng_seed(&r, rng_hash(seed ^ 0x776564676573ULL, b));
+    for (tries = 0; tries < 64; tries++) {
+      v = rng_below(&r, g->n);
+      if ((d = g->degrees[v]) < 2)
+	continue;
+      i = rng_below(&r, d);
+      j = rng_below(&r, d - 1);
+      j += j >= i;
+      wedges++;
+      closed += graph_has_arc(g, g->links[v][i], g->links[v][j]);
+      break;
+    }
+  }
+  p->clustering = wedges ? (double)closed / wedges : 0;
+}
+
+/**
+   Writes g in the input format: the number of nodes, the degree of each
+   node, then each link once. Ranges of nodes are printed in parallel to
+   memory, then written in order.
+*/
+void downsample_write(graph *g, FILE *output) {
+  int parts = PREPROCESS_PARTS * omp_get_max_threads(), k, *bounds = (int *) malloc((parts+1) * sizeof(int));
+  char **texts = (char **) calloc(parts, sizeof(char *));
+  size_t *lengths = (size_t *) calloc(parts, sizeof(size_t));
+  int pass;
+  assert(bounds != NULL && texts != NULL && lengths != NULL);
+  graph_balanced_ranges(g, parts, bounds);
+  fprintf(output, "%d\n", g->n);
+  for (pass = 0; pass < 2; pass++) { // degrees, then links
+    #pragma omp parallel for schedule(dynamic,1)
+    for (k = 0; k < parts; k++) {
+      FILE *text = open_memstream(texts + k, lengths + k);
+      int u, i;
+      assert(text != NULL);
+      for (u = bounds[k]; u < bounds[k+1]; u++)
+	if (pass == 0)
+	  fprintf(text, "%d %d\n", u, g->degrees[u]);
+	else
+	  for (i = 0; i < g->degrees[u]; i++)
+	    if (u < g->links[u][i])
+	      fprintf(text, "%d %d\n", u, g->links[u][i]);
+      fclose(text);
+    }
+    for (k = 0; k < parts; k++) {
+      fwrite(texts[k], 1, lengths[k], output);
+      free(texts[k]);
+    }
+  }
+  free(texts);
+  free(lengths);
+  free(bounds);
+}
@@ -0,0 +1,130 @@
+/*
+  FRONTIER BENCHMARK:
+  Times a full breadth-first traversal of a graph with the ring Queue, the
+  serial Frontier and the concurrent Frontier (per-thread blocks).
+
+  Usage: frontier-bench GRAPH_PATH [RUNS] [NUM_THREADS]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <omp.h>
+
+#include "prelim.c"
+#include "queue.c"
+#include "frontier.c"
+
+int bfs_queue(graph *g, int *visited, int source) {
+  Queue *q = queue_new(g->n);
+  int i, u, v, reached = 1;
+  visited[source] = 1;
+  queue_add(q, source);
+  while (!queue_empty(q)) {
+    u = queue_get(q);
+    for (i = 0; i < g->degrees[u]; i++) {
+      v = g->links[u][i];
+      if (!visited[v]) {
+	visited[v] = visited[u]+1;
+	queue_add(q, v);
+	reached++;
+      }
+    }
+  }
+  queue_destroy(q);
+  return reached;
+}
+
+int bfs_frontier(graph *g, int *visited, int source) {
+  Frontier *f = frontier_new(g->n);
+  int i, k, u, v, reached = 1;
+  visited[source] = 1;
+  frontier_add(f, source);
+  for (frontier_swap(f); !frontier_empty(f); frontier_swap(f))
+    for (k = 0; k < f->size; k++) {
+      u = f->current[k];
+      for (i = 0; i < g->degrees[u]; i++) {
+	v = g->links[u][i];
+	if (!visited[v]) {
+	  visited[v] = visited[u]+1;
+	  frontier_add(f, v);
+	  reached++;
+	}
+      }
+    }
+  frontier_destroy(f);
+  return reached;
+}
+
+int bfs_frontier_concurrent(graph *g, int *visited, int source) {
+  Frontier *f = frontier_new(g->n);
+  int reached = 1;
+  visited[source] = 1;
+  frontier_add(f, source);
+  for (frontier_swap(f); !frontier_empty(f); frontier_swap(f))
+    #pragma omp parallel reduction(+:reached)
+    {
+      FrontierBlock block;
+      int i, k, u, v, expected;
+      block.size = 0;
+      #pragma omp for schedule(dynamic,64)
+      for (k = 0; k < f->size; k++) {
+	u = f->current[k];
+	for (i = 0; i < g->degrees[u]; i++) {
+	  v = g->links[u][i];
+	  expected = 0;
+	  if (__atomic_load_n(visited+v, __ATOMIC_RELAXED) == 0 &&
+	      __atomic_compare_exchange_n(visited+v, &expected, visited[u]+1, 0,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	    frontier_add_block(f, &block, v);
+	    reached++;
+	  }
+	}
+      }
+      frontier_flush(f, &block);
+    }
+  frontier_destroy(f);
+  return reached;
+}
+
+int main(int argc, char **argv) {
+  const char *names[] = {"ring queue", "frontier", "concurrent frontier"};
+  int (*bfs[])(graph *, int *, int) = {bfs_queue, bfs_frontier, bfs_frontier_concurrent};
+  int b, r, runs, reached = 0, *visited;
+  double start, elapsed;
+  FILE *input;
+  graph *g;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s GRAPH_PATH [RUNS] [NUM_THREADS]\n", argv[0]);
+    return 1;
+  }
+  runs = argc > 2 ? atoi(argv[2]) : 10;
+  if (argc > 3)
+    omp_set_num_threads(atoi(argv[3]));
+  assert(runs > 0);
+  input = fopen(argv[1], "r");
+  assert(input != NULL);
+  g = graph_from_file(input);
+  fclose(input);
+  visited = (int *) malloc(g->n * sizeof(int));
+  assert(visited != NULL);
+
+  fprintf(stderr, "Graph with %d nodes, %d links; %d runs, %d threads\n",
+	  g->n, g->m, runs, omp_get_max_threads());
+  for (b = 0; b < 3; b++) {
+    elapsed = 0;
+    for (r = 0; r < runs; r++) {
+      memset(visited, 0, g->n * sizeof(int));
+      start = omp_get_wtime();
+      reached = bfs[b](g, visited, r % g->n);
+      elapsed += omp_get_wtime() - start;
+    }
+    printf("%-20s %10.3f ms/run %10.2f Marcs/s (%d nodes reached)\n", names[b],
+	   1e3 * elapsed / runs, 2e-6 * g->m * runs / elapsed, reached);
+  }
+  free(visited);
+  free_graph(g);
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+  Frontier of a level-synchronous spreading: the nodes of the current level
+  and the nodes being added for the next one, in two arrays swapped between
+  levels. Serial producers append with frontier_add(); concurrent producers
+  fill a private FrontierBlock and copy it to the next level after reserving
+  room with a single atomic add, so that no lock is ever taken.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define FRONTIER_BLOCK 64 // nodes buffered by a concurrent producer
+
+typedef struct _Frontier {
+  int size;               // number of nodes in the current level
+  int next_size;          // number of nodes added to the next level
+  int *current;           // current level
+  int *next;              // next level
+} Frontier;
+
+typedef struct _FrontierBlock {
+  int size;
+  int nodes[FRONTIER_BLOCK];
+} FrontierBlock;
+
+Frontier *frontier_new(int n) {
+  Frontier *f = (Frontier *) malloc(sizeof(Frontier));
+  assert(f != NULL);
+  f->current = (int *) malloc((n > 0 ? n : 1) * sizeof(int));
+  f->next = (int *) malloc((n > 0 ? n : 1) * sizeof(int));
+  assert(f->current != NULL && f->next != NULL);
+  f->size = f->next_size = 0;
+  return f;
+}
+
+void frontier_destroy(Frontier *f) {
+  assert(f != NULL);
+  free(f->current);
+  free(f->next);
+  free(f);
+}
+
+static inline int frontier_empty(Frontier *f) { return f->size == 0; }
+
+static inline void frontier_add(Frontier *f, int v) {
+  f->next[f->next_size++] = v;
+}
+
+/**
+   Makes the next level the current one and empties the next level
+*/
+static inline void frontier_swap(Frontier *f) {
+  int *tmp = f->current;
+  f->current = f->next;
+  f->next = tmp;
+  f->size = f->next_size;
+  f->next_size = 0;
+}
+
+/**
+   Copies the nodes of a block to the next level, concurrently with other blocks
+*/
+static inline void frontier_flush(Frontier *f, FrontierBlock *b) {
+  int start;
+  if (b->size) {
+    start = __atomic_fetch_add(&f->next_size, b->size, __ATOMIC_RELAXED);
+    memcpy(f->next + start, b->nodes, b->size * sizeof(int));
+    b->size = 0;
+  }
+}
+
+static inline void frontier_add_block(Frontier *f, FrontierBlock *b, int v) {
+  b->nodes[b->size++] = v;
+  if (b->size == FRONTIER_BLOCK)
+    frontier_flush(f, b);
+}
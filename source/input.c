@@ -0,0 +1,467 @@
+/*
+  Input files, plain or compressed (recognized by their magic number, not
+  their name): gzip, and zstd if compiled with HAVE_ZSTD. Compressed files
+  made of independent blocks whose sizes are known upfront, i.e. BGZF
+  files (bgzip) and zstd files of several frames (zstd -T, pzstd) holding
+  their content sizes, are decompressed by all threads at once straight
+  into the final buffer; other ones are decompressed by a single thread,
+  without an intermediate file or pipe. Graphs are then parsed in parallel
+  from the memory buffer (graph_from_text); the other inputs are read from
+  it through a FILE stream (input_open).
+*/
+
+#include <limits.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define INPUT_READ (16L << 20)     // bytes read at once
+#define INPUT_PARSE_PARTS 16       // parse chunks per thread
+
+typedef struct _InputBlock {
+  size_t offset, size;    // compressed block in the file
+  size_t start, length;   // its content in the decompressed buffer
+} InputBlock;
+
+/**
+   Reads a whole stream into a buffer, with room for a final '\0'
+*/
+static char *input_read(FILE *input, size_t *size) {
+  size_t capacity = INPUT_READ, n;
+  char *data = (char *) malloc(capacity + 1);
+  assert(data != NULL);
+  *size = 0;
+  while ((n = fread(data + *size, 1, capacity - *size, input)) > 0) {
+    *size += n;
+    if (*size == capacity) {
+      capacity *= 2;
+      data = (char *) realloc(data, capacity + 1);
+      assert(data != NULL);
+    }
+  }
+  if (ferror(input))
+    report_error("input_read: read error");
+  return data;
+}
+
+static inline uint32_t input_le32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+   Splits gzip data into BGZF blocks, each a gzip member whose header holds
+   its size (extra subfield 'BC') and whose trailer holds the size of its
+   content. Returns their number, or 0 if the data is not BGZF.
+*/
+static long gzip_blocks(const unsigned char *data, size_t size, InputBlock **blocks) {
+  long n = 0, capacity = 1024;
+  size_t offset = 0, start = 0, bsize, xlen, k;
+  *blocks = (InputBlock *) malloc(capacity * sizeof(InputBlock));
+  assert(*blocks != NULL);
+  while (offset < size) {
+    if (offset + 18 > size || data[offset] != 0x1f || data[offset+1] != 0x8b || !(data[offset+3] & 4))
+      break;
+    xlen = data[offset+10] | (data[offset+11] << 8);
+    for (k = offset + 12, bsize = 0; k + 4 <= offset + 12 + xlen && k + 4 <= size; k += 4 + (data[k+2] | (data[k+3] << 8)))
+      if (data[k] == 'B' && data[k+1] == 'C' && k + 6 <= size) {
+	bsize = (data[k+4] | (data[k+5] << 8)) + 1;
+	break;
+      }
+    if (bsize == 0 || offset + bsize > size)
+      break;
+    if (n == capacity) {
+      capacity *= 2;
+      *blocks = (InputBlock *) realloc(*blocks, capacity * sizeof(InputBlock));
+      assert(*blocks != NULL);
+    }
+    (*blocks)[n].offset = offset;
+    (*blocks)[n].size = bsize;
+    (*blocks)[n].start = start;
+    start += (*blocks)[n++].length = input_le32(data + offset + bsize - 4);
+    offset += bsize;
+  }
+  if (offset != size) {
+    free(*blocks);
+    *blocks = NULL;
+    return 0;
+  }
+  return n;
+}
+
+/**
+   Decompresses gzip data (one or more members) with a single thread
+*/
+static char *gzip_inflate(unsigned char *data, size_t size, size_t *length) {
+  z_stream z;
+  size_t capacity = 4 * size + INPUT_READ;
+  char *out = (char *) malloc(capacity + 1);
+  int status = Z_OK;
+  assert(out != NULL);
+  memset(&z, 0, sizeof(z_stream));
+  if (inflateInit2(&z, 15 + 16) != Z_OK)
+    report_error("gzip_inflate: zlib error");
+  *length = 0;
+  z.next_in = data;
+  while (size > 0) {
+    z.avail_in = size > (1U << 30) ? (1U << 30) : size;
+    size -= z.avail_in;
+    do {
+      if (*length == capacity) {
+	capacity *= 2;
+	out = (char *) realloc(out, capacity + 1);
+	assert(out != NULL);
+      }
+      z.next_out = (unsigned char *) out + *length;
+      z.avail_out = capacity - *length > (1U << 30) ? (1U << 30) : capacity - *length;
+      status = inflate(&z, Z_NO_FLUSH);
+      *length = (char *) z.next_out - out;
+      if (status == Z_STREAM_END && z.avail_in > 0) // next member
+	status = inflateReset(&z);
+      if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+	report_error("gzip_inflate: corrupted gzip data");
+    } while (z.avail_in > 0 || z.avail_out == 0);
+  }
+  if (status != Z_STREAM_END)
+    report_error("gzip_inflate: truncated gzip data");
+  inflateEnd(&z);
+  return out;
+}
+
+/**
+   Decompresses BGZF blocks in parallel
+*/
+static char *gzip_inflate_blocks(unsigned char *data, InputBlock *blocks, long n, size_t *length) {
+  char *out;
+  long k;
+  *length = n > 0 ? blocks[n-1].start + blocks[n-1].length : 0;
+  out = (char *) malloc(*length + 1);
+  assert(out != NULL);
+  #pragma omp parallel for schedule(dynamic,16)
+  for (k = 0; k < n; k++) {
+    z_stream z;
+    memset(&z, 0, sizeof(z_stream));
+    if (inflateInit2(&z, 15 + 16) != Z_OK)
+      report_error("gzip_inflate_blocks: zlib error");
+    z.next_in = data + blocks[k].offset;
+    z.avail_in = blocks[k].size;
+    z.next_out = (unsigned char *) out + blocks[k].start;
+    z.avail_out = blocks[k].length;
+    if (inflate(&z, Z_FINISH) != Z_STREAM_END || z.avail_out != 0)
+      report_error("gzip_inflate_blocks: corrupted BGZF block");
+    inflateEnd(&z);
+  }
+  return out;
+}
+
+#ifdef HAVE_ZSTD
+/**
+   Decompresses zstd data: frames in parallel if all of them hold their
+   content size, otherwise with a single thread
+*/
+static char *zstd_decompress(unsigned char *data, size_t size, size_t *length, long *parallel) {
+  InputBlock *blocks = NULL;
+  long n = 0, capacity = 0, k;
+  size_t offset = 0, bytes;
+  unsigned long long content;
+  char *out;
+  ZSTD_DCtx *context;
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer o;
+  *length = 0;
+  while (offset < size) {
+    bytes = ZSTD_findFrameCompressedSize(data + offset, size - offset);
+    if (ZSTD_isError(bytes))
+      report_error("zstd_decompress: corrupted zstd data");
+    content = ZSTD_getFrameContentSize(data + offset, size - offset);
+    if (content == ZSTD_CONTENTSIZE_ERROR || content == ZSTD_CONTENTSIZE_UNKNOWN) {
+      n = -1;
+      break;
+    }
+    if (n == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      blocks = (InputBlock *) realloc(blocks, capacity * sizeof(InputBlock));
+      assert(blocks != NULL);
+    }
+    blocks[n].offset = offset;
+    blocks[n].size = bytes;
+    blocks[n].start = *length;
+    *length += blocks[n++].length = content;
+    offset += bytes;
+  }
+  if (n >= 0) {
+    out = (char *) malloc(*length + 1);
+    assert(out != NULL);
+    #pragma omp parallel for schedule(dynamic,1)
+    for (k = 0; k < n; k++)
+      if (ZSTD_decompress(out + blocks[k].start, blocks[k].length,
+			  data + blocks[k].offset, blocks[k].size) != blocks[k].length)
+	report_error("zstd_decompress: corrupted zstd frame");
+    free(blocks);
+    *parallel = n > 1 ? n : 0;
+    return out;
+  }
+  // frames of unknown sizes: streaming decompression
+  free(blocks);
+  *parallel = 0;
+  capacity = 4 * size + INPUT_READ;
+  out = (char *) malloc(capacity + 1);
+  context = ZSTD_createDCtx();
+  assert(out != NULL && context != NULL);
+  in.src = data;
+  in.size = size;
+  in.pos = 0;
+  *length = 0;
+  for (;;) {
+    if (*length == (size_t)capacity) {
+      capacity *= 2;
+      out = (char *) realloc(out, capacity + 1);
+      assert(out != NULL);
+    }
+    o.dst = out;
+    o.size = capacity;
+    o.pos = *length;
+    if (ZSTD_isError(ZSTD_decompressStream(context, &o, &in)))
+      report_error("zstd_decompress: corrupted zstd data");
+    *length = o.pos;
+    if (in.pos == in.size && *length < (size_t)capacity) // all flushed
+      break;
+  }
+  ZSTD_freeDCtx(context);
+  return out;
+}
+#endif
+
+/**
+   Loads the content of the file at path (stdin if NULL), decompressed if
+   needed, into a buffer ending with '\0'. *blocks is set to the number of
+   blocks decompressed in parallel (0 if none, -1 if not compressed).
+*/
+char *input_load(const char *path, size_t *size, long *blocks) {
+  FILE *input = path ? fopen(path, "rb") : stdin;
+  unsigned char *data;
+  char *text;
+  InputBlock *parts;
+  size_t length;
+  if (input == NULL)
+    report_error("input_load: cannot open the input file");
+  data = (unsigned char *) input_read(input, &length);
+  if (input != stdin)
+    fclose(input);
+  *blocks = -1;
+  if (length >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+    if ((*blocks = gzip_blocks(data, length, &parts)) > 0) {
+      text = gzip_inflate_blocks(data, parts, *blocks, size);
+      free(parts);
+    } else
+      text = gzip_inflate(data, length, size);
+    free(data);
+  } else if (length >= 4 && input_le32(data) == 0xfd2fb528U) {
+#ifdef HAVE_ZSTD
+    text = zstd_decompress(data, length, size, blocks);
+    free(data);
+#else
+    report_error("input_load: zstd input, compile with HAVE_ZSTD (make ZSTD=1)");
+    text = NULL;
+#endif
+  } else {
+    text = (char *) data;
+    *size = length;
+  }
+  text[*size] = '\0';
+  return text;
+}
+
+typedef struct _InputCookie {
+  char *text;             // content of the input
+  size_t size;            // its size
+  size_t position;        // bytes read
+} InputCookie;
+
+static ssize_t input_cookie_read(void *cookie, char *buffer, size_t size) {
+  InputCookie *c = (InputCookie *) cookie;
+  if (size > c->size - c->position)
+    size = c->size - c->position;
+  memcpy(buffer, c->text + c->position, size);
+  c->position += size;
+  return size;
+}
+
+static int input_cookie_close(void *cookie) {
+  free(((InputCookie *) cookie)->text);
+  free(cookie);
+  return 0;
+}
+
+/**
+   Opens the file at path for reading, decompressed if needed; returns NULL
+   if it cannot be opened
+*/
+FILE *input_open(const char *path) {
+  cookie_io_functions_t functions = {input_cookie_read, NULL, NULL, input_cookie_close};
+  InputCookie *cookie;
+  unsigned char magic[4];
+  FILE *input = fopen(path, "r");
+  size_t n;
+  long blocks;
+  if (input == NULL)
+    return NULL;
+  n = fread(magic, 1, 4, input);
+  if (!((n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) || (n == 4 && input_le32(magic) == 0xfd2fb528U))) {
+    rewind(input);
+    return input;
+  }
+  fclose(input);
+  cookie = (InputCookie *) malloc(sizeof(InputCookie));
+  assert(cookie != NULL);
+  cookie->text = input_load(path, &cookie->size, &blocks);
+  cookie->position = 0;
+  return fopencookie(cookie, "r", functions);
+}
+
+/**
+   Parses a non-negative integer at *p, skipping blanks before it; returns
+   0 if there is none
+*/
+static inline int input_int(const char **p, int *value) {
+  const char *s = *p;
+  long v = 0;
+  while (*s == ' ' || *s == '\t' || *s == '\r')
+    s++;
+  if (*s < '0' || *s > '9')
+    return 0;
+  while (*s >= '0' && *s <= '9' && v <= INT_MAX)
+    v = 10 * v + (*s++ - '0');
+  if (v > INT_MAX)
+    return 0;
+  *value = v;
+  *p = s;
+  return 1;
+}
+
+/**
+   Whether only blanks are left before the end of the line at p
+*/
+static inline int input_eol(const char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r')
+    p++;
+  return *p == '\n' || *p == '\0';
+}
+
+static void input_line_error(const char *line, long number, char *error) {
+  const char *end = strchr(line, '\n');
+  fprintf(stderr, "Line %ld: %.*s\n", number + 1, end ? (int)(end - line) : (int)strlen(line), line);
+  report_error(error);
+}
+
+/**
+   Reads a graph in the format of graph_from_file from the text of a file.
+   The lines are parsed in parallel, by chunks; the links are then added in
+   file order, so that adjacency lists are the same as graph_from_file's.
+   If directed, the degrees are out-degrees and each link u v is the arc
+   u -> v, stored in the list of u only.
+*/
+graph *graph_from_text(char *text, size_t size, int directed) {
+  int parts = INPUT_PARSE_PARTS * omp_get_max_threads(), k;
+  long *lines = (long *) calloc(parts + 1, sizeof(long)), num_lines, e;
+  size_t *start = (size_t *) malloc((parts + 1) * sizeof(size_t));
+  int *ends, u, v, n;
+  const char *p = text;
+  graph *g = (graph *) malloc(sizeof(graph));
+  assert(lines != NULL && start != NULL && g != NULL);
+
+  // chunks of whole lines, and their first line numbers
+  for (k = 0; k <= parts; k++) {
+    start[k] = k == parts ? size : size * k / parts;
+    while (start[k] > 0 && start[k] < size && text[start[k] - 1] != '\n')
+      start[k]++;
+  }
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    const char *q = text + start[k], *end = text + start[k+1];
+    long count = 0;
+    while (q < end && (q = memchr(q, '\n', end - q)) != NULL) {
+      count++;
+      q++;
+    }
+    lines[k+1] = count;
+  }
+  for (k = 0; k < parts; k++)
+    lines[k+1] += lines[k];
+  num_lines = lines[parts] + (size > 0 && text[size-1] != '\n'); // the last line may lack its '\n'
+
+  // the number of nodes, then the degrees and links
+  if (!input_int(&p, &g->n) || !input_eol(p))
+    report_error("graph_from_text: read error 1");
+  if (num_lines - 1 < g->n)
+    report_error("graph_from_text: read error 2");
+  g->capacities = (int *) malloc((g->n > 0 ? g->n : 1) * sizeof(int));
+  g->degrees = (int *) calloc(g->n > 0 ? g->n : 1, sizeof(int));
+  ends = (int *) malloc(2 * (num_lines - 1 - g->n > 0 ? num_lines - 1 - g->n : 1) * sizeof(int));
+  assert(g->capacities != NULL && g->degrees != NULL && ends != NULL);
+  n = g->n;
+  #pragma omp parallel for schedule(dynamic,1) private(e, u, v)
+  for (k = 0; k < parts; k++) {
+    const char *q = text + start[k], *end = text + start[k+1], *b;
+    long line;
+    for (line = lines[k]; q < end; line++) {
+      b = q;
+      if (line == 0)
+	;
+      else if (line <= n) {
+	if (!input_int(&q, &v) || !input_int(&q, g->capacities + line - 1) || !input_eol(q))
+	  input_line_error(b, line, "graph_from_text: read error (degrees)");
+	if (v != line - 1)
+	  input_line_error(b, line, "graph_from_text: error while reading degrees");
+      } else {
+	e = line - 1 - n;
+	if (!input_int(&q, &u) || !input_int(&q, &v) || !input_eol(q))
+	  input_line_error(b, line, "graph_from_text: read error (links)");
+	if (u >= n || v >= n)
+	  input_line_error(b, line, "graph_from_text: bad node number");
+	ends[2*e] = u;
+	ends[2*e+1] = v;
+      }
+      q = memchr(q, '\n', end - q);
+      if (q == NULL)
+	break;
+      q++;
+    }
+  }
+
+  // the links, in file order
+  for (u = 0, e = 0; u < n; u++)
+    e += g->capacities[u];
+  g->directed = directed;
+  g->m = directed ? e : e / 2;
+  if (num_lines - 1 - n != g->m)
+    report_error("graph_from_text: the number of links does not match the degrees");
+  if (n == 0) {
+    g->links = NULL;
+  } else {
+    g->links = (int **) malloc(n * sizeof(int *));
+    assert(g->links != NULL);
+    g->links[0] = (int *) malloc((e > 0 ? e : 1) * sizeof(int));
+    assert(g->links[0] != NULL);
+    for (u = 1; u < n; u++)
+      g->links[u] = g->links[u-1] + g->capacities[u-1];
+  }
+  for (e = 0; e < g->m; e++) {
+    u = ends[2*e];
+    v = ends[2*e+1];
+    if (g->degrees[u] >= g->capacities[u] || (!directed && g->degrees[v] >= g->capacities[v])) {
+      fprintf(stderr, "reading link %d %d\n", u, v);
+      report_error("graph_from_text: too many links for a node");
+    }
+    g->links[u][g->degrees[u]++] = v;
+    if (!directed)
+      g->links[v][g->degrees[v]++] = u;
+  }
+  for (u = 0; u < n; u++)
+    if (g->degrees[u] != g->capacities[u])
+      report_error("graph_from_text: capacities <> degrees");
+  free(ends);
+  free(lines);
+  free(start);
+  return g;
+}
@@ -0,0 +1,229 @@
+/*
+  Provider load: the number of successful contacts (trace events) of every
+  provider at every time step, summed over all epidemics and samples. Each
+  thread counts them in its own sparse table, keyed by (time step,
+  provider), without any synchronization; at the end, the tables are
+  merged in parallel into, for every time step, a histogram of the
+  provider loads, and the providers of highest peak load.
+*/
+
+#define LOAD_TOP 10        // default number of top providers reported
+#define LOAD_BINS 32       // histogram bins: loads in [2^b, 2^(b+1))
+
+typedef struct _LoadTable {
+  uint64_t *keys;         // (t << 32 | provider) + 1 of each slot, 0 if free
+  long *counts;           // contacts of each slot
+  long size;              // used slots
+  long capacity;          // number of slots, a power of 2
+} __attribute__((aligned(64))) LoadTable;
+
+typedef struct _ProviderLoad {
+  int num_threads;        // number of tables
+  LoadTable *tables;      // one per thread
+  int top;                // number of top providers reported
+} ProviderLoad;
+
+typedef struct _LoadEntry {
+  int t;                  // time step
+  int provider;           // provider
+  long count;             // its contacts at t
+} LoadEntry;
+
+ProviderLoad *provider_load = NULL; // if set, provider load is accumulated
+
+static inline uint64_t load_hash(uint64_t key) {
+  return key * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline long load_slot(uint64_t key, long capacity) {
+  return (long)(load_hash(key) >> 20) & (capacity - 1);
+}
+
+static void load_table_init(LoadTable *table, long capacity) {
+  table->keys = (uint64_t *) calloc(capacity, sizeof(uint64_t));
+  table->counts = (long *) malloc(capacity * sizeof(long));
+  assert(table->keys != NULL && table->counts != NULL);
+  table->size = 0;
+  table->capacity = capacity;
+}
+
+static void load_table_insert(LoadTable *table, uint64_t key, long count);
+
+static void load_table_grow(LoadTable *table) {
+  LoadTable old = *table;
+  long k;
+  load_table_init(table, 2 * old.capacity);
+  for (k = 0; k < old.capacity; k++)
+    if (old.keys[k])
+      load_table_insert(table, old.keys[k], old.counts[k]);
+  free(old.keys);
+  free(old.counts);
+}
+
+static void load_table_insert(LoadTable *table, uint64_t key, long count) {
+  long k;
+  if (2 * (table->size + 1) > table->capacity)
+    load_table_grow(table);
+  for (k = load_slot(key, table->capacity); table->keys[k] && table->keys[k] != key; k = (k + 1) & (table->capacity - 1))
+    ;
+  if (table->keys[k])
+    table->counts[k] += count;
+  else {
+    table->keys[k] = key;
+    table->counts[k] = count;
+    table->size++;
+  }
+}
+
+ProviderLoad *load_new(int num_threads, int top) {
+  ProviderLoad *l = (ProviderLoad *) malloc(sizeof(ProviderLoad));
+  int k;
+  assert(l != NULL && num_threads > 0 && top >= 0);
+  l->num_threads = num_threads;
+  l->top = top;
+  l->tables = (LoadTable *) aligned_alloc(64, num_threads * sizeof(LoadTable));
+  assert(l->tables != NULL);
+  for (k = 0; k < num_threads; k++)
+    load_table_init(l->tables + k, 1024);
+  return l;
+}
+
+void load_destroy(ProviderLoad *l) {
+  int k;
+  for (k = 0; k < l->num_threads; k++) {
+    free(l->tables[k].keys);
+    free(l->tables[k].counts);
+  }
+  free(l->tables);
+  free(l);
+}
+
+/**
+   Counts count contacts of provider u at time t, in the table of the
+   calling thread
+*/
+static inline void load_add(int t, int u, long count) {
+  load_table_insert(provider_load->tables + omp_get_thread_num(),
+		    (((uint64_t)(uint32_t)t << 32) | (uint32_t)u) + 1, count);
+}
+
+static int load_entry_compare(const void *a, const void *b) {
+  const LoadEntry *x = (const LoadEntry *) a, *y = (const LoadEntry *) b;
+  if (x->t != y->t)
+    return x->t < y->t ? -1 : 1;
+  return (x->provider > y->provider) - (x->provider < y->provider);
+}
+
+/**
+   Whether provider a has a higher peak load than b, or the same and more
+   contacts
+*/
+static inline int load_heavier(long *peak, long *total, int a, int b) {
+  return peak[a] > peak[b] || (peak[a] == peak[b] && total[a] > total[b]);
+}
+
+static inline int load_bin(long count) {
+  int b = 0;
+  while (count >>= 1)
+    b++;
+  return b < LOAD_BINS ? b : LOAD_BINS - 1;
+}
+
+/**
+   Merges the thread tables and writes, for every time step, the number of
+   providers, their contacts, the highest load and the histogram of loads
+   (providers of load 1, 2-3, 4-7, ...), then the l->top providers of
+   highest peak load over n nodes. Returns the number of (time step,
+   provider) pairs.
+*/
+long load_write(ProviderLoad *l, int n, FILE *output) {
+  int parts = l->num_threads, k, b, bins, num_top = 0, *peak_t, *top;
+  long size = 0, *offset = (long *) calloc(parts + 1, sizeof(long)), e, f, hist[LOAD_BINS], requests, max;
+  long *peak = (long *) calloc(n > 0 ? n : 1, sizeof(long)), *total = (long *) calloc(n > 0 ? n : 1, sizeof(long));
+  LoadTable *merged = (LoadTable *) malloc(parts * sizeof(LoadTable));
+  LoadEntry *entries;
+  peak_t = (int *) calloc(n > 0 ? n : 1, sizeof(int));
+  top = (int *) malloc((l->top > 0 ? l->top : 1) * sizeof(int));
+  assert(offset != NULL && peak != NULL && total != NULL && merged != NULL && peak_t != NULL && top != NULL);
+
+  // part k merges the keys of its hash range from all tables
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int j;
+    long s;
+    load_table_init(merged + k, 1024);
+    for (j = 0; j < l->num_threads; j++)
+      for (s = 0; s < l->tables[j].capacity; s++)
+	if (l->tables[j].keys[s] && (load_hash(l->tables[j].keys[s]) >> 44) % parts == (uint64_t)k)
+	  load_table_insert(merged + k, l->tables[j].keys[s], l->tables[j].counts[s]);
+    offset[k+1] = merged[k].size;
+  }
+  for (k = 0; k < parts; k++)
+    offset[k+1] += offset[k];
+  size = offset[parts];
+  entries = (LoadEntry *) malloc((size > 0 ? size : 1) * sizeof(LoadEntry));
+  assert(entries != NULL);
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    long s, at = offset[k];
+    for (s = 0; s < merged[k].capacity; s++)
+      if (merged[k].keys[s]) {
+	entries[at].t = (merged[k].keys[s] - 1) >> 32;
+	entries[at].provider = (uint32_t)(merged[k].keys[s] - 1);
+	entries[at++].count = merged[k].counts[s];
+      }
+    free(merged[k].keys);
+    free(merged[k].counts);
+  }
+  qsort(entries, size, sizeof(LoadEntry), load_entry_compare);
+
+  // histogram of every time step
+  fprintf(output, "# t providers contacts max_load providers_of_load_1 2-3 4-7 ...\n");
+  for (e = 0; e < size; e = f) {
+    memset(hist, 0, sizeof(hist));
+    requests = max = 0;
+    bins = 0;
+    for (f = e; f < size && entries[f].t == entries[e].t; f++) {
+      b = load_bin(entries[f].count);
+      hist[b]++;
+      bins = b + 1 > bins ? b + 1 : bins;
+      requests += entries[f].count;
+      max = entries[f].count > max ? entries[f].count : max;
+      k = entries[f].provider;
+      total[k] += entries[f].count;
+      if (entries[f].count > peak[k]) {
+	peak[k] = entries[f].count;
+	peak_t[k] = entries[f].t;
+      }
+    }
+    fprintf(output, "%d %ld %ld %ld", entries[e].t, f - e, requests, max);
+    for (b = 0; b < bins; b++)
+      fprintf(output, " %ld", hist[b]);
+    fputc('\n', output);
+  }
+
+  // top providers by peak load, then contacts, then id (insertion)
+  for (b = 0; b < n; b++) {
+    if (peak[b] == 0)
+      continue;
+    for (k = num_top; k > 0 && load_heavier(peak, total, b, top[k-1]); k--)
+      if (k < l->top)
+	top[k] = top[k-1];
+    if (k < l->top) {
+      top[k] = b;
+      num_top += num_top < l->top;
+    }
+  }
+  fprintf(output, "# top providers: rank provider peak_load peak_t contacts\n");
+  for (k = 0; k < num_top; k++)
+    fprintf(output, "top %d %d %ld %d %ld\n", k+1, top[k], peak[top[k]], peak_t[top[k]], total[top[k]]);
+
+  free(entries);
+  free(merged);
+  free(offset);
+  free(peak);
+  free(peak_t);
+  free(total);
+  free(top);
+  return size;
+}
@@ -0,0 +1,278 @@
+/*
+  Live metrics: the simulation threads count arcs, infections and epidemics
+  in per-thread counters, once per time step, with relaxed atomic stores
+  (each counter has a single writer); an exporter thread sums them every
+  few seconds and publishes them in the Prometheus text format, either to
+  a file (for the textfile collector of node_exporter), replaced
+  atomically, or to whoever connects to a local Unix socket.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define METRICS_INTERVAL 5.0 // default seconds between updates
+#define METRICS_TEXT 4096    // max length of the metrics text
+
+typedef struct _MetricsCounters {
+  long arcs;              // arcs tried
+  long infections;        // nodes infected
+  long started;           // sample epidemics started
+  long completed;         // sample epidemics completed
+  long frontier;          // active nodes of the epidemic running on the thread
+} __attribute__((aligned(64))) MetricsCounters;
+
+typedef struct _Metrics {
+  int num_threads;        // number of counters
+  MetricsCounters *counters; // one per thread, on its own cache line
+  long epidemics;         // sample epidemics to run
+  FILE *output;           // if set, trace output whose size is reported
+  const char *path;       // textfile or socket path
+  int listener;           // listening socket, -1 if publishing to a file
+  double interval;        // seconds between updates
+  double start;           // start time
+  int wakeup[2];          // pipe written to stop the exporter
+  pthread_t thread;       // exporter thread
+  pthread_mutex_t lock;   // protects output and epidemics
+} Metrics;
+
+Metrics *metrics = NULL; // if set, live metrics are exported
+
+static inline void metrics_store(long *counter, long value) {
+  __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline long metrics_load(long *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+   Accounts for a time step of the epidemic running on the calling thread
+*/
+static inline void metrics_step(long arcs, long infections, long frontier) {
+  MetricsCounters *c;
+  if (metrics == NULL)
+    return;
+  c = metrics->counters + omp_get_thread_num();
+  metrics_store(&c->arcs, c->arcs + arcs);
+  metrics_store(&c->infections, c->infections + infections);
+  metrics_store(&c->frontier, frontier);
+}
+
+static inline void metrics_epidemic(int completed) {
+  MetricsCounters *c;
+  if (metrics == NULL)
+    return;
+  c = metrics->counters + omp_get_thread_num();
+  if (completed) {
+    metrics_store(&c->completed, c->completed + 1);
+    metrics_store(&c->frontier, 0);
+  } else
+    metrics_store(&c->started, c->started + 1);
+}
+
+/**
+   Resident set size of the process, in bytes
+*/
+static long metrics_rss() {
+  long pages = 0, resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm) {
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+   Writes the current metrics into text; *arcs and *infections hold the
+   totals of the previous update, *last its time, for the rates. They are
+   updated if 'update' is set.
+*/
+static int metrics_format(Metrics *m, char *text, long *arcs, long *infections, double *last, int update) {
+  long a = 0, i = 0, started = 0, completed = 0, frontier = 0, bytes = -1, epidemics;
+  double now = omp_get_wtime(), dt = now - *last > 0 ? now - *last : 1;
+  int k, len;
+  for (k = 0; k < m->num_threads; k++) {
+    a += metrics_load(&m->counters[k].arcs);
+    i += metrics_load(&m->counters[k].infections);
+    started += metrics_load(&m->counters[k].started);
+    completed += metrics_load(&m->counters[k].completed);
+    frontier += metrics_load(&m->counters[k].frontier);
+  }
+  pthread_mutex_lock(&m->lock);
+  if (m->output)
+    bytes = ftell(m->output);
+  epidemics = m->epidemics;
+  pthread_mutex_unlock(&m->lock);
+  len = snprintf(text, METRICS_TEXT,
+		 "# HELP scascade_arcs_total Arcs tried by the spreading.\n"
+		 "# TYPE scascade_arcs_total counter\nscascade_arcs_total %ld\n"
+		 "# HELP scascade_arcs_per_second Arcs tried per second since the last update.\n"
+		 "# TYPE scascade_arcs_per_second gauge\nscascade_arcs_per_second %.1f\n"
+		 "# HELP scascade_infections_total Nodes infected.\n"
+		 "# TYPE scascade_infections_total counter\nscascade_infections_total %ld\n"
+		 "# HELP scascade_infections_per_second Nodes infected per second since the last update.\n"
+		 "# TYPE scascade_infections_per_second gauge\nscascade_infections_per_second %.1f\n"
+		 "# HELP scascade_epidemics_completed_total Sample epidemics completed.\n"
+		 "# TYPE scascade_epidemics_completed_total counter\nscascade_epidemics_completed_total %ld\n"
+		 "# HELP scascade_epidemics_running Sample epidemics running.\n"
+		 "# TYPE scascade_epidemics_running gauge\nscascade_epidemics_running %ld\n"
+		 "# HELP scascade_epidemics_pending Sample epidemics not started yet.\n"
+		 "# TYPE scascade_epidemics_pending gauge\nscascade_epidemics_pending %ld\n"
+		 "# HELP scascade_frontier_nodes Active nodes of the running epidemics.\n"
+		 "# TYPE scascade_frontier_nodes gauge\nscascade_frontier_nodes %ld\n"
+		 "# HELP scascade_resident_memory_bytes Resident memory size.\n"
+		 "# TYPE scascade_resident_memory_bytes gauge\nscascade_resident_memory_bytes %ld\n"
+		 "# HELP scascade_elapsed_seconds Time since the start of the exporter.\n"
+		 "# TYPE scascade_elapsed_seconds gauge\nscascade_elapsed_seconds %.1f\n",
+		 a, (a - *arcs) / dt, i, (i - *infections) / dt, completed, started - completed,
+		 epidemics > started ? epidemics - started : 0, frontier, metrics_rss(), now - m->start);
+  if (bytes >= 0 && len < METRICS_TEXT)
+    len += snprintf(text + len, METRICS_TEXT - len,
+		    "# HELP scascade_output_bytes_total Bytes written to the trace.\n"
+		    "# TYPE scascade_output_bytes_total counter\nscascade_output_bytes_total %ld\n", bytes);
+  if (update) {
+    *arcs = a;
+    *infections = i;
+    *last = now;
+  }
+  return len < METRICS_TEXT ? len : METRICS_TEXT - 1;
+}
+
+/**
+   Sends the metrics to a client of the socket, whole: short writes go on
+   where they stopped. Returns 0 if the client left.
+*/
+static int metrics_send(int client, const char *text, int len) {
+  ssize_t sent;
+  while (len > 0) {
+    sent = write(client, text, len);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return 0;
+    text += sent;
+    len -= sent;
+  }
+  return 1;
+}
+
+/**
+   Replaces the textfile with the metrics: written aside, then renamed
+*/
+static void metrics_publish_file(Metrics *m, char *text, int len) {
+  char tmp_path[4096];
+  FILE *output;
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", m->path);
+  output = fopen(tmp_path, "w");
+  if (output == NULL)
+    return;
+  fwrite(text, 1, len, output);
+  if (fclose(output) == 0)
+    rename(tmp_path, m->path);
+}
+
+static void *metrics_exporter(void *arg) {
+  Metrics *m = (Metrics *) arg;
+  char text[METRICS_TEXT];
+  long arcs = 0, infections = 0;
+  double last = m->start, wait;
+  int len, client, ready;
+  struct pollfd fds[2];
+
+  fds[0].fd = m->wakeup[0];
+  fds[1].fd = m->listener;
+  fds[0].events = fds[1].events = POLLIN;
+  for (;;) {
+    wait = last + m->interval - omp_get_wtime();
+    if (wait <= 0) {
+      len = metrics_format(m, text, &arcs, &infections, &last, 1);
+      if (m->listener < 0)
+	metrics_publish_file(m, text, len);
+      wait = m->interval;
+    }
+    ready = poll(fds, m->listener < 0 ? 1 : 2, (int)(wait * 1000) + 1);
+    if (ready > 0 && fds[0].revents)
+      break;
+    // serve the metrics to a client of the socket, with the rates since the last update
+    if (ready > 0 && (fds[1].revents & POLLIN) && (client = accept(m->listener, NULL, NULL)) >= 0) {
+      len = metrics_format(m, text, &arcs, &infections, &last, 0);
+      metrics_send(client, text, len); // the client may have left
+      close(client);
+    }
+  }
+  if (m->listener < 0)
+    metrics_publish_file(m, text, metrics_format(m, text, &arcs, &infections, &last, 1));
+  return NULL;
+}
+
+/**
+   Starts the exporter: to the Unix socket at path if it starts with
+   "unix:", otherwise to the textfile at path
+*/
+Metrics *metrics_start(const char *path, double interval, int num_threads) {
+  Metrics *m = (Metrics *) calloc(1, sizeof(Metrics));
+  struct sockaddr_un address;
+  assert(m != NULL);
+  assert(interval > 0);
+  m->num_threads = num_threads;
+  m->counters = (MetricsCounters *) aligned_alloc(64, num_threads * sizeof(MetricsCounters));
+  assert(m->counters != NULL);
+  memset(m->counters, 0, num_threads * sizeof(MetricsCounters));
+  m->interval = interval;
+  m->start = omp_get_wtime();
+  m->listener = -1;
+  m->path = path;
+  if (strncmp(path, "unix:", 5) == 0) {
+    m->path = path + 5;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(m->path) >= sizeof(address.sun_path))
+      report_error("metrics_start: socket path too long");
+    strcpy(address.sun_path, m->path);
+    unlink(m->path);
+    m->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m->listener < 0 || bind(m->listener, (struct sockaddr *) &address, sizeof(address)) != 0
+	|| listen(m->listener, 16) != 0)
+      report_error("metrics_start: cannot listen on the socket");
+  }
+  if (pipe(m->wakeup) != 0)
+    report_error("metrics_start: pipe() error");
+  pthread_mutex_init(&m->lock, NULL);
+  if (pthread_create(&m->thread, NULL, metrics_exporter, m) != 0)
+    report_error("metrics_start: cannot start the exporter thread");
+  return m;
+}
+
+/**
+   Sets the trace output whose size is reported, and the number of sample
+   epidemics to run
+*/
+void metrics_expect(Metrics *m, FILE *output, long epidemics) {
+  pthread_mutex_lock(&m->lock);
+  m->output = output;
+  m->epidemics = epidemics;
+  pthread_mutex_unlock(&m->lock);
+}
+
+/**
+   Publishes the final metrics and stops the exporter
+*/
+void metrics_stop(Metrics *m) {
+  if (write(m->wakeup[1], "", 1) != 1)
+    report_error("metrics_stop: cannot wake the exporter up");
+  pthread_join(m->thread, NULL);
+  close(m->wakeup[0]);
+  close(m->wakeup[1]);
+  if (m->listener >= 0) {
+    close(m->listener);
+    unlink(m->path);
+  }
+  pthread_mutex_destroy(&m->lock);
+  free(m->counters);
+  free(m);
+}
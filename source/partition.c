@@ -0,0 +1,453 @@
+/*
+  Partitioned simulation of one epidemic by several local worker processes.
+  The nodes are split into ranges holding about the same number of arcs;
+  each worker owns the infection state of its range and expands the arcs
+  of its active nodes. Each time step:
+  - every worker tries the arcs of its share of the frontier and sends each
+    spreading attempt to the owner of the client, through a single-producer
+    single-consumer ring in shared memory (one per pair of workers);
+  - after a barrier, the owners claim their new nodes: a node goes to its
+    first attempt in the serial order, i.e. the smallest key (position of
+    the provider in the frontier, arc index), so new nodes ranked by key
+    form the next frontier in the order of epidemic_run();
+  - after another barrier, every worker ranks its new nodes among those of
+    all workers, which gives their frontier positions.
+  Workers append their trace events, with their keys, to private files,
+  and the parent process merges each step by frontier position, so that
+  the trace is the one of the serial epidemic_run().
+
+  An arc is tried at most once per epidemic, so a ring sized by the number
+  of arcs between two ranges never fills up. Workers only communicate
+  through the rings and barriers, as processes of separate machines would
+  (the graph is inherited at fork, but each worker only reads its range).
+*/
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define PARTITION_EVENTS 4096 // trace events buffered by a worker or read by the parent
+
+typedef struct _PartitionMessage {
+  int client;             // contacted node
+  int pos;                // frontier position of the provider
+  int arc;                // arc index at the provider
+} PartitionMessage;
+
+typedef struct _PartitionEvent {
+  int pos;                // frontier position of the provider
+  int arc;                // arc index at the provider
+  int provider;           // infecting node
+  int client;             // contacted node
+} PartitionEvent;
+
+typedef struct _PartitionClaim {
+  uint64_t key;           // key of the first attempt on the node
+  int node;               // claimed node
+} PartitionClaim;
+
+typedef struct _PartitionRing {
+  long head;              // messages consumed, written by the consumer
+  long tail;              // messages produced, written by the producer
+  long capacity;          // room in messages
+  long offset;            // first message in the shared message area
+} __attribute__((aligned(64))) PartitionRing;
+
+typedef struct _PartitionShared {
+  long events_end[2];     // end of the worker's events in its file, by step parity
+  long new_nodes;         // nodes claimed by the worker at the step
+  long links;             // cascade links of the step at the worker
+  long cut_links;         // the same, up to the last infection allowed by the size bound
+} __attribute__((aligned(64))) PartitionShared;
+
+typedef struct _Partition {
+  int parts;              // number of workers
+  int *bounds;            // worker w owns nodes bounds[w], ..., bounds[w+1]-1
+  graph *g;               // underlying graph
+  InitialCondition *ic;   // initial condition
+  uint64_t threshold;     // p scaled for arc_coin()
+  uint64_t seed;          // seed of the arc coins
+  ArcVariates variates;   // transform of their uniforms
+  int tracing;            // whether events are recorded
+  TraceFilter *filter;    // if set, events kept in the trace
+  int *files;             // event file of each worker
+  void *memory;           // shared memory
+  size_t size;            // its size
+  pthread_barrier_t *barrier; // barrier of the workers and the parent
+  PartitionShared *shared;    // per worker
+  PartitionRing *rings;       // ring from worker q to worker r at q*parts+r
+  PartitionMessage *messages; // messages of all rings
+  uint64_t *keys;             // claim keys of the new nodes, by worker from bounds[w]
+} Partition;
+
+static inline int partition_owner(Partition *pt, int v) {
+  int left = 0, right = pt->parts - 1, mid;
+  while (left < right) {
+    mid = (left + right + 1) / 2;
+    if (pt->bounds[mid] <= v)
+      left = mid;
+    else
+      right = mid - 1;
+  }
+  return left;
+}
+
+static inline uint64_t partition_key(int pos, int arc) {
+  return ((uint64_t)(uint32_t)pos << 32) | (uint32_t)arc;
+}
+
+static int claim_compare(const void *a, const void *b) {
+  uint64_t x = ((const PartitionClaim *) a)->key, y = ((const PartitionClaim *) b)->key;
+  return (x > y) - (x < y);
+}
+
+/**
+   Number of keys of a sorted array smaller than key
+*/
+static long keys_rank(uint64_t *keys, long n, uint64_t key) {
+  long left = 0, right = n, mid;
+  while (left < right) {
+    mid = (left + right) / 2;
+    if (keys[mid] < key)
+      left = mid + 1;
+    else
+      right = mid;
+  }
+  return left;
+}
+
+/**
+   The r-th smallest key (from 0) of the new nodes of all workers
+*/
+static uint64_t partition_select(Partition *pt, long r) {
+  long *next = (long *) calloc(pt->parts, sizeof(long));
+  uint64_t key = 0;
+  int w, best;
+  assert(next != NULL);
+  for (; r >= 0; r--) {
+    for (w = 0, best = -1; w < pt->parts; w++)
+      if (next[w] < pt->shared[w].new_nodes &&
+	  (best < 0 || pt->keys[pt->bounds[w] + next[w]] < pt->keys[pt->bounds[best] + next[best]]))
+	best = w;
+    assert(best >= 0);
+    key = pt->keys[pt->bounds[best] + next[best]++];
+  }
+  free(next);
+  return key;
+}
+
+/**
+   Lays the shared memory out: rings sized by the arcs between the ranges
+*/
+static void partition_map(Partition *pt) {
+  int q, r, u, i, P = pt->parts;
+  long *arcs = (long *) calloc(P * P, sizeof(long)), messages = 0;
+  size_t offset, keys;
+  pthread_barrierattr_t attr;
+  assert(arcs != NULL);
+  for (q = 0; q < P; q++)
+    for (u = pt->bounds[q]; u < pt->bounds[q+1]; u++)
+      for (i = 0; i < pt->g->degrees[u]; i++)
+	arcs[q*P + partition_owner(pt, pt->g->links[u][i])]++;
+  for (q = 0; q < P*P; q++)
+    messages += arcs[q] + 1;
+
+  offset = 64 + P * sizeof(PartitionShared) + P * P * sizeof(PartitionRing);
+  keys = (offset + messages * sizeof(PartitionMessage) + 63) & ~(size_t)63;
+  pt->size = keys + ((size_t)pt->g->n + 1) * sizeof(uint64_t);
+  pt->memory = mmap(NULL, pt->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (pt->memory == MAP_FAILED)
+    report_error("partition_map: cannot map the shared memory");
+  pt->barrier = (pthread_barrier_t *) pt->memory;
+  assert(sizeof(pthread_barrier_t) <= 64);
+  pt->shared = (PartitionShared *) ((char *) pt->memory + 64);
+  pt->rings = (PartitionRing *) (pt->shared + P);
+  pt->messages = (PartitionMessage *) ((char *) pt->memory + offset);
+  pt->keys = (uint64_t *) ((char *) pt->memory + keys);
+  for (q = 0, messages = 0; q < P; q++)
+    for (r = 0; r < P; r++) {
+      pt->rings[q*P + r].capacity = arcs[q*P + r] + 1;
+      pt->rings[q*P + r].offset = messages;
+      messages += arcs[q*P + r] + 1;
+    }
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(pt->barrier, &attr, P + 1);
+  pthread_barrierattr_destroy(&attr);
+  free(arcs);
+}
+
+static void partition_flush(Partition *pt, int w, PartitionEvent *events, int *num_events) {
+  ssize_t bytes = *num_events * sizeof(PartitionEvent);
+  if (bytes && write(pt->files[w], events, bytes) != bytes)
+    report_error("partition_flush: write error");
+  *num_events = 0;
+}
+
+/**
+   Worker w: spreads the epidemic from its range, step by step, in sync with
+   the other workers and the parent (see partition_run)
+*/
+static void partition_worker(Partition *pt, int w) {
+  graph *g = pt->g;
+  InitialCondition *ic = pt->ic;
+  int P = pt->parts, lo = pt->bounds[w], own = pt->bounds[w+1] - lo;
+  int *infected = (int *) calloc(own + 1, sizeof(int));   // time of infection of the owned nodes
+  uint64_t *claim = (uint64_t *) malloc((own + 1) * sizeof(uint64_t)); // their claim keys
+  PartitionClaim *fresh = (PartitionClaim *) malloc((own + 1) * sizeof(PartitionClaim)); // new nodes of the step
+  int *node = (int *) malloc((own + 1) * sizeof(int)), *pos = (int *) malloc((own + 1) * sizeof(int));
+  uint64_t *seen = (uint64_t *) calloc(g->n / 64 + 1, sizeof(uint64_t)), key, cut;
+  long *tail = (long *) calloc(P, sizeof(long)), *end = (long *) calloc(P, sizeof(long)), total, links, num_infected = ic->num_infected;
+  PartitionEvent *events = (PartitionEvent *) malloc(PARTITION_EVENTS * sizeof(PartitionEvent));
+  PartitionRing *ring;
+  PartitionMessage *m;
+  long k, x;
+  int i, q, t, u, v, size = 0, num_fresh, num_events = 0, tracing, max_infected = ic_max_infected(ic);
+  assert(infected && claim && fresh && node && pos && seen && tail && end && events);
+
+  // the initial frontier, in the order of the initial condition
+  for (i = 0, k = 0; i < ic->num_infected; i++) {
+    v = ic->infected[i];
+    if ((seen[v >> 6] >> (v & 63)) & 1)
+      continue;
+    seen[v >> 6] |= 1ULL << (v & 63);
+    if (v >= lo && v < lo + own) {
+      infected[v - lo] = 1;
+      node[size] = v;
+      pos[size++] = k;
+    }
+    k++;
+  }
+  num_infected = k; // repeated initial nodes count once
+  free(seen);
+  for (q = 0; q < P; q++)
+    tail[q] = pt->rings[w*P + q].tail;
+
+  for (t = 1; t <= ic_max_time(ic); t++) {
+    // spreading attempts from the owned frontier nodes
+    tracing = pt->tracing && (!pt->filter || trace_filter_time(pt->filter, t));
+    for (k = 0; k < size; k++) {
+      u = node[k];
+      for (i = 0; i < g->degrees[u]; i++) {
+	if (!arc_coin(pt->seed, u, i, pt->threshold, &pt->variates))
+	  continue;
+	v = g->links[u][i];
+	q = partition_owner(pt, v);
+	ring = pt->rings + w*P + q;
+	assert(tail[q] - ring->head < ring->capacity);
+	m = pt->messages + ring->offset + tail[q]++ % ring->capacity;
+	m->client = v;
+	m->pos = pos[k];
+	m->arc = i;
+	if (tracing && (!pt->filter || trace_filter_nodes(pt->filter, u, v))) {
+	  if (num_events == PARTITION_EVENTS)
+	    partition_flush(pt, w, events, &num_events);
+	  events[num_events].pos = pos[k];
+	  events[num_events].arc = i;
+	  events[num_events].provider = u;
+	  events[num_events++].client = v;
+	}
+      }
+    }
+    partition_flush(pt, w, events, &num_events);
+    pt->shared[w].events_end[t & 1] = lseek(pt->files[w], 0, SEEK_CUR);
+    for (q = 0; q < P; q++)
+      __atomic_store_n(&pt->rings[w*P + q].tail, tail[q], __ATOMIC_RELEASE);
+    pthread_barrier_wait(pt->barrier);
+
+    // claims of the owned clients: the first attempt in serial order wins
+    // (the producers may append the messages of the next step meanwhile)
+    num_fresh = 0;
+    links = 0;
+    for (q = 0; q < P; q++) {
+      ring = pt->rings + q*P + w;
+      end[q] = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+      for (x = ring->head; x < end[q]; x++) {
+	m = pt->messages + ring->offset + x % ring->capacity;
+	v = m->client - lo;
+	key = partition_key(m->pos, m->arc);
+	if (!infected[v]) {
+	  infected[v] = t+1;
+	  claim[v] = key;
+	  fresh[num_fresh++].node = v;
+	} else if (infected[v] != t+1)
+	  continue;
+	else if (key < claim[v])
+	  claim[v] = key;
+	links++;
+      }
+    }
+    for (k = 0; k < num_fresh; k++)
+      fresh[k].key = claim[fresh[k].node];
+    qsort(fresh, num_fresh, sizeof(PartitionClaim), claim_compare);
+    for (k = 0; k < num_fresh; k++)
+      pt->keys[lo + k] = fresh[k].key;
+    pt->shared[w].new_nodes = num_fresh;
+    pt->shared[w].links = links;
+    pthread_barrier_wait(pt->barrier);
+
+    for (q = 0, total = 0; q < P; q++)
+      total += pt->shared[q].new_nodes;
+    if (num_infected < max_infected && (long)num_infected + total >= max_infected) {
+      // the epidemic stops at the infection of rank max_infected - num_infected
+      cut = partition_select(pt, max_infected - num_infected - 1);
+      links = 0;
+      for (q = 0; q < P; q++) {
+	ring = pt->rings + q*P + w;
+	for (x = ring->head; x < end[q]; x++) {
+	  m = pt->messages + ring->offset + x % ring->capacity;
+	  v = m->client - lo;
+	  key = partition_key(m->pos, m->arc);
+	  links += key <= cut && infected[v] == t+1 && claim[v] <= cut;
+	}
+      }
+      pt->shared[w].cut_links = links;
+      pthread_barrier_wait(pt->barrier);
+      break;
+    }
+    num_infected += total;
+    if (total == 0)
+      break;
+
+    // next frontier: the new nodes ranked among those of all workers
+    for (q = 0; q < P; q++)
+      __atomic_store_n(&pt->rings[q*P + w].head, end[q], __ATOMIC_RELEASE);
+    for (k = 0; k < num_fresh; k++) {
+      for (q = 0, x = k; q < P; q++)
+	if (q != w)
+	  x += keys_rank(pt->keys + pt->bounds[q], pt->shared[q].new_nodes, fresh[k].key);
+      pos[k] = x;
+      node[k] = fresh[k].node + lo;
+    }
+    size = num_fresh;
+  }
+  _exit(0);
+}
+
+/**
+   Writes the events of step t, up to key 'cut', merging the events of the
+   workers by frontier position; start[w] is where those of worker w begin
+*/
+static void partition_trace(Partition *pt, int t, uint64_t cut, long *start, FILE *output,
+			    TraceIndex *index, int id) {
+  int P = pt->parts, w, best;
+  long end;
+  PartitionEvent *events = (PartitionEvent *) malloc(P * PARTITION_EVENTS * sizeof(PartitionEvent)), *e;
+  int *num = (int *) calloc(P, sizeof(int)), *next = (int *) calloc(P, sizeof(int));
+  long n;
+  assert(events != NULL && num != NULL && next != NULL);
+  for (;;) {
+    for (w = 0, best = -1; w < P; w++) {
+      end = pt->shared[w].events_end[t & 1];
+      if (next[w] == num[w] && start[w] < end) {
+	n = (end - start[w]) / sizeof(PartitionEvent);
+	n = n < PARTITION_EVENTS ? n : PARTITION_EVENTS;
+	if (pread(pt->files[w], events + w*PARTITION_EVENTS, n * sizeof(PartitionEvent), start[w])
+	    != (ssize_t)(n * sizeof(PartitionEvent)))
+	  report_error("partition_trace: read error");
+	start[w] += n * sizeof(PartitionEvent);
+	num[w] = n;
+	next[w] = 0;
+      }
+      if (next[w] < num[w] && (best < 0 || events[w*PARTITION_EVENTS + next[w]].pos <
+			       events[best*PARTITION_EVENTS + next[best]].pos))
+	best = w;
+    }
+    if (best < 0)
+      break;
+    e = events + best*PARTITION_EVENTS + next[best]++;
+    if (partition_key(e->pos, e->arc) > cut)
+      break;
+    trace_print(output, index, t, e->provider, e->client, id);
+  }
+  // skip what follows the cut
+  for (w = 0; w < P; w++)
+    start[w] = pt->shared[w].events_end[t & 1];
+  free(events);
+  free(num);
+  free(next);
+}
+
+/**
+   Runs the epidemic of ic with 'parts' worker processes, writing its trace
+   to output (if set) as epidemic_run() would; the outcome is stored in
+   the state of epidemic, which is not run.
+*/
+void partition_run(Epidemic *epidemic, InitialCondition *ic, int parts, const char *tmp_dir) {
+  Partition pt;
+  char path[MAX_PATH_LENGTH];
+  long *start, total;
+  uint64_t cut;
+  pid_t *workers;
+  int w, t, status, max_infected = ic_max_infected(ic);
+
+  pt.parts = parts;
+  pt.g = epidemic->g;
+  pt.ic = ic;
+  pt.threshold = epidemic->threshold;
+  pt.variates = epidemic->variates;
+  pt.seed = epidemic->seed;
+  pt.tracing = epidemic->output != NULL;
+  pt.filter = epidemic->filter;
+  pt.bounds = (int *) malloc((parts + 1) * sizeof(int));
+  pt.files = (int *) malloc(parts * sizeof(int));
+  start = (long *) calloc(parts, sizeof(long));
+  workers = (pid_t *) malloc(parts * sizeof(pid_t));
+  assert(pt.bounds && pt.files && start && workers);
+  graph_balanced_ranges(pt.g, parts, pt.bounds);
+  partition_map(&pt);
+  for (w = 0; w < parts; w++) {
+    snprintf(path, MAX_PATH_LENGTH, "%s/scascade-XXXXXX", tmp_dir);
+    pt.files[w] = mkstemp(path);
+    if (pt.files[w] < 0)
+      report_error("partition_run: cannot create a file in the tmp dir");
+    unlink(path);
+  }
+
+  fflush(NULL);
+  for (w = 0; w < parts; w++) {
+    workers[w] = fork();
+    if (workers[w] < 0)
+      report_error("partition_run: fork() error");
+    if (workers[w] == 0)
+      partition_worker(&pt, w);
+  }
+
+  // follow the workers step by step, writing the trace
+  for (t = 1; t <= ic_max_time(ic); t++) {
+    pthread_barrier_wait(pt.barrier);
+    pthread_barrier_wait(pt.barrier);
+    for (w = 0, total = 0; w < parts; w++)
+      total += pt.shared[w].new_nodes;
+    if (epidemic->num_infected < max_infected && (long)epidemic->num_infected + total >= max_infected) {
+      cut = partition_select(&pt, max_infected - epidemic->num_infected - 1);
+      if (epidemic->output)
+	partition_trace(&pt, t, cut, start, epidemic->output, epidemic->index, epidemic->id);
+      pthread_barrier_wait(pt.barrier);
+      for (w = 0; w < parts; w++)
+	epidemic->cascade_links += pt.shared[w].cut_links;
+      epidemic->num_infected = max_infected;
+      epidemic->t = t;
+      break;
+    }
+    for (w = 0; w < parts; w++)
+      epidemic->cascade_links += pt.shared[w].links;
+    if (epidemic->output)
+      partition_trace(&pt, t, UINT64_MAX, start, epidemic->output, epidemic->index, epidemic->id);
+    if (total == 0)
+      break;
+    epidemic->num_infected += total;
+    epidemic->t = t;
+  }
+
+  for (w = 0; w < parts; w++) {
+    if (waitpid(workers[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      report_error("partition_run: a worker failed");
+    close(pt.files[w]);
+  }
+  pthread_barrier_destroy(pt.barrier);
+  munmap(pt.memory, pt.size);
+  free(pt.bounds);
+  free(pt.files);
+  free(start);
+  free(workers);
+}
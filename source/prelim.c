@@ -13,6 +13,7 @@ typedef struct graph{
   int **links;
   int *degrees;
   int *capacities;
+  int directed; /* links are arcs u -> v, stored at u only */
 } graph;
 
 /******** UTILITY functions - begin *********/
@@ -92,7 +93,7 @@ int rand_index_max_array(int *a, int n){
 
 /* in-place quicksort from Fabien Viger */
 /* Median of three int */
-inline int med3(int a, int b, int c) {
+static inline int med3(int a, int b, int c) {
   if(a<b) {
     if(c<b) return (a<c) ? c : a;
     else return b;
@@ -104,7 +105,7 @@ inline int med3(int a, int b, int c) {
 }
 
 /* Sort integer arrays in ASCENDING order */
-inline void isort(int *v, int t) {
+static inline void isort(int *v, int t) {
   int i;
   if(t<2) return;
   for(i=1; i<t; i++) {
@@ -194,6 +195,7 @@ graph *graph_from_file(FILE *f){
 
   if( (g=(graph *)malloc(sizeof(graph))) == NULL )
     report_error("graph_from_file: malloc() error 1");
+  g->directed = 0;
   
   /* read n */
   if( fgets(line,MAX_LINE_LENGTH,f) == NULL )
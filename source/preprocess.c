@@ -0,0 +1,295 @@
+/*
+  Graph preprocessing: sorting of the adjacency lists, removal of self-loops
+  and duplicate links, and symmetrization. Nodes are processed in parallel
+  ranges holding about the same number of arcs, so that a few hubs do not
+  serialize the work.
+*/
+
+#define PREPROCESS_PARTS 16 // node ranges per thread
+
+typedef struct _PrepReport {
+  long self_loops;        // self-loop arcs removed
+  long duplicates;        // duplicate arcs removed
+  long reversed;          // reverse arcs added by symmetrization
+} PrepReport;
+
+/**
+   Splits the nodes into 'parts' ranges [bounds[k], bounds[k+1]) holding
+   about the same number of arcs
+*/
+void graph_balanced_ranges(graph *g, int parts, int *bounds) {
+  long arcs = 0, total = 0;
+  int k = 1, u;
+  for (u = 0; u < g->n; u++)
+    total += g->degrees[u];
+  bounds[0] = 0;
+  for (u = 0; u < g->n && k < parts; u++) {
+    arcs += g->degrees[u];
+    while (k < parts && arcs * parts >= total * k)
+      bounds[k++] = u+1;
+  }
+  while (k <= parts)
+    bounds[k++] = g->n;
+}
+
+static int graph_parts(graph *g) {
+  int parts = PREPROCESS_PARTS * omp_get_max_threads();
+  return parts < g->n ? parts : (g->n > 0 ? g->n : 1);
+}
+
+/**
+   Binary search of v in the sorted adjacency list of u
+*/
+static inline int graph_has_arc(graph *g, int u, int v) {
+  int left = 0, right = g->degrees[u] - 1, mid;
+  while (left <= right) {
+    mid = (left + right) / 2;
+    if (g->links[u][mid] < v)
+      left = mid + 1;
+    else if (g->links[u][mid] > v)
+      right = mid - 1;
+    else
+      return 1;
+  }
+  return 0;
+}
+
+/**
+   Sorts every adjacency list and removes self-loops and duplicate arcs, so
+   that each pair of nodes is tried at most once per spreading step
+*/
+void graph_clean(graph *g, PrepReport *report) {
+  int k, parts = graph_parts(g);
+  long self_loops = 0, duplicates = 0, arcs = 0;
+  int *bounds = (int *) malloc((parts+1) * sizeof(int));
+  assert(bounds != NULL);
+  graph_balanced_ranges(g, parts, bounds);
+
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:self_loops,duplicates,arcs)
+  for (k = 0; k < parts; k++) {
+    int u, i, d, *links;
+    for (u = bounds[k]; u < bounds[k+1]; u++) {
+      links = g->links[u];
+      quicksort(links, g->degrees[u]);
+      for (i = d = 0; i < g->degrees[u]; i++)
+	if (links[i] == u)
+	  self_loops++;
+	else if (d > 0 && links[d-1] == links[i])
+	  duplicates++;
+	else
+	  links[d++] = links[i];
+      g->degrees[u] = d;
+      arcs += d;
+    }
+  }
+  g->m = g->directed ? arcs : arcs / 2;
+  report->self_loops += self_loops;
+  report->duplicates += duplicates;
+  free(bounds);
+}
+
+/**
+   Adds the missing reverse arc of every arc; the adjacency lists must be
+   sorted (see graph_clean). The links are moved to a new contiguous block.
+*/
+void graph_symmetrize(graph *g, PrepReport *report) {
+  int k, u, parts = graph_parts(g);
+  long reversed = 0, arcs = 0;
+  int *bounds, *missing, *block;
+  if (g->n == 0)
+    return;
+  bounds = (int *) malloc((parts+1) * sizeof(int));
+  missing = (int *) calloc(g->n, sizeof(int));
+  assert(bounds != NULL && missing != NULL);
+  graph_balanced_ranges(g, parts, bounds);
+
+  // count the missing reverse arcs of every node
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:reversed)
+  for (k = 0; k < parts; k++) {
+    int u, i, v;
+    for (u = bounds[k]; u < bounds[k+1]; u++)
+      for (i = 0; i < g->degrees[u]; i++) {
+	v = g->links[u][i];
+	if (!graph_has_arc(g, v, u)) {
+	  __atomic_fetch_add(missing+v, 1, __ATOMIC_RELAXED);
+	  reversed++;
+	}
+      }
+  }
+  if (reversed == 0) {
+    if (g->directed) {
+      g->m /= 2;
+      g->directed = 0;
+    }
+    free(bounds);
+    free(missing);
+    return;
+  }
+
+  // new block with room for them
+  for (u = 0; u < g->n; u++)
+    arcs += g->degrees[u] + missing[u];
+  if( (block=(int *)malloc(arcs*sizeof(int))) == NULL )
+    report_error("graph_symmetrize: malloc() error");
+  arcs = 0;
+  for (u = 0; u < g->n; u++) {
+    memcpy(block + arcs, g->links[u], g->degrees[u] * sizeof(int));
+    g->capacities[u] = g->degrees[u] + missing[u];
+    arcs += g->capacities[u];
+  }
+  free(g->links[0]);
+  for (u = 0, arcs = 0; u < g->n; arcs += g->capacities[u], u++)
+    g->links[u] = block + arcs;
+
+  // fill them: old arcs are still sorted, only the new ones are compared
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int u, i, v, at, n;
+    for (u = bounds[k]; u < bounds[k+1]; u++)
+      for (i = 0, n = g->degrees[u]; i < n; i++) {
+	v = g->links[u][i];
+	if (!graph_has_arc(g, v, u)) {
+	  at = __atomic_fetch_add(missing+v, -1, __ATOMIC_RELAXED) - 1;
+	  g->links[v][g->capacities[v] - 1 - at] = u;
+	}
+      }
+  }
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int u;
+    for (u = bounds[k]; u < bounds[k+1]; u++)
+      if (g->degrees[u] != g->capacities[u]) {
+	g->degrees[u] = g->capacities[u];
+	quicksort(g->links[u], g->degrees[u]);
+      }
+  }
+  g->m = arcs / 2;
+  g->directed = 0;
+  report->reversed += reversed;
+  free(bounds);
+  free(missing);
+}
+
+/**
+   Returns the transpose of g, a new graph with the arc v -> u for every
+   arc u -> v of g: the reverse lists are filled in parallel, then sorted,
+   so that they list their sources in increasing order
+*/
+graph *graph_transpose(graph *g) {
+  graph *r = (graph *) malloc(sizeof(graph));
+  int k, u, parts = graph_parts(g), *bounds, *fill;
+  long arcs = 0;
+  assert(r != NULL);
+  r->n = g->n;
+  r->m = g->m;
+  r->directed = g->directed;
+  r->degrees = (int *) calloc(g->n > 0 ? g->n : 1, sizeof(int));
+  r->capacities = (int *) malloc((g->n > 0 ? g->n : 1) * sizeof(int));
+  r->links = g->n > 0 ? (int **) malloc(g->n * sizeof(int *)) : NULL;
+  bounds = (int *) malloc((parts+1) * sizeof(int));
+  assert(r->degrees != NULL && r->capacities != NULL && (g->n == 0 || r->links != NULL) && bounds != NULL);
+  if (g->n == 0) {
+    free(bounds);
+    return r;
+  }
+  graph_balanced_ranges(g, parts, bounds);
+
+  // in-degrees, then a contiguous block laid out by them
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int u, i;
+    for (u = bounds[k]; u < bounds[k+1]; u++)
+      for (i = 0; i < g->degrees[u]; i++)
+	__atomic_fetch_add(r->degrees + g->links[u][i], 1, __ATOMIC_RELAXED);
+  }
+  for (u = 0; u < g->n; u++)
+    arcs += r->capacities[u] = r->degrees[u];
+  if( (r->links[0]=(int *)malloc((arcs > 0 ? arcs : 1)*sizeof(int))) == NULL )
+    report_error("graph_transpose: malloc() error");
+  for (u = 1; u < g->n; u++)
+    r->links[u] = r->links[u-1] + r->capacities[u-1];
+
+  // fill the lists backwards, each from its end, then sort them
+  fill = r->degrees;
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int u, i, v;
+    for (u = bounds[k]; u < bounds[k+1]; u++)
+      for (i = 0; i < g->degrees[u]; i++) {
+	v = g->links[u][i];
+	r->links[v][__atomic_sub_fetch(fill + v, 1, __ATOMIC_RELAXED)] = u;
+      }
+  }
+  #pragma omp parallel for
+  for (u = 0; u < g->n; u++)
+    r->degrees[u] = r->capacities[u];
+  graph_balanced_ranges(r, parts, bounds);
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int u;
+    for (u = bounds[k]; u < bounds[k+1]; u++)
+      quicksort(r->links[u], r->degrees[u]);
+  }
+  free(bounds);
+  return r;
+}
+
+/**
+   Renames every node u to perm[u], in parallel, reusing the graph arrays
+   as scratch space. Returns the new id of node 0, whose adjacency list
+   starts the links block (see free_graph_old_start); 0 for an empty
+   graph, which is left as it is.
+*/
+int graph_relabel(graph *g, int *perm) {
+  int k, u, parts = graph_parts(g), *bounds, *tmp;
+  int **links;
+  if (g->n == 0)
+    return 0;
+  bounds = (int *) malloc((parts+1) * sizeof(int));
+  links = (int **) malloc(g->n * sizeof(int *));
+  assert(bounds != NULL && links != NULL);
+  graph_balanced_ranges(g, parts, bounds);
+
+  #pragma omp parallel for schedule(dynamic,1)
+  for (k = 0; k < parts; k++) {
+    int u, i;
+    for (u = bounds[k]; u < bounds[k+1]; u++)
+      for (i = 0; i < g->degrees[u]; i++)
+	g->links[u][i] = perm[g->links[u][i]];
+  }
+
+  #pragma omp parallel for
+  for (u = 0; u < g->n; u++)
+    links[perm[u]] = g->links[u];
+  tmp = (int *) g->links; // n pointers: room for n ints
+  g->links = links;
+  #pragma omp parallel for
+  for (u = 0; u < g->n; u++)
+    tmp[perm[u]] = g->degrees[u];
+  links = (int **) g->degrees;
+  g->degrees = tmp;
+  tmp = (int *) links;
+  #pragma omp parallel for
+  for (u = 0; u < g->n; u++)
+    tmp[perm[u]] = g->capacities[u];
+  free(g->capacities);
+  g->capacities = tmp;
+  free(bounds);
+  return perm[0];
+}
+
+/**
+   Relabels the nodes with a uniform random permutation drawn from seed.
+   Returns the permutation (node u is now perm[u]); *old_0 is set to the
+   new id of node 0, for free_graph_old_start.
+*/
+int *graph_random_relabel(graph *g, uint64_t seed, int *old_0) {
+  int u, *perm = (int *) malloc((g->n > 0 ? g->n : 1) * sizeof(int));
+  assert(perm != NULL);
+  #pragma omp parallel for
+  for (u = 0; u < g->n; u++)
+    perm[u] = u;
+  rng_shuffle(perm, g->n, seed);
+  *old_0 = graph_relabel(g, perm);
+  return perm;
+}
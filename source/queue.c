@@ -8,8 +8,8 @@ typedef struct _Queue {
   int *nodes;
 } Queue;
 
-inline int queue_empty(Queue *q){ return (q->begin == q->end); }
-inline int queue_full(Queue *q) { return (q->begin == (q->end+1) % q->size); }
+static inline int queue_empty(Queue *q){ return (q->begin == q->end); }
+static inline int queue_full(Queue *q) { return (q->begin == (q->end+1) % q->size); }
 
 Queue *queue_new(int size) {
   Queue *q = (Queue *) malloc(sizeof(Queue));
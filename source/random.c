@@ -0,0 +1,209 @@
+/*
+  Random numbers for the simulation: a counter-based hash deciding each arc
+  coin from (seed, provider, arc index), so that an epidemic's outcome does
+  not depend on the order (or the thread) in which its arcs are tried, and
+  a small seeded stream generator for everything else.
+
+  The arc uniforms of the samples of an epidemic may be made dependent, to
+  reduce the variance of the estimates over the samples: the samples then
+  come in groups that share a seed, and each sample transforms the uniforms
+  of its group (see arc_sample). Antithetic pairs complement them; the
+  samples of a randomized lattice (quasi-Monte Carlo) add to the uniform of
+  each arc, taken as a random shift, the points i * z / M of a rank-1
+  lattice of M points, where z is an odd multiplier drawn per arc, so that
+  the M uniforms of every arc fall in the M strata of [0, 1).
+*/
+
+#include <stdint.h>
+
+#define ARC_UNIFORMS ((1ULL << 53) - 1) // mask of the 53-bit arc uniforms
+#define VARIATES_LATTICE_GROUPS 8       // min number of randomized lattices of the samples
+
+typedef enum _Variates {VariatesIndependent, VariatesAntithetic, VariatesLattice} Variates;
+
+typedef struct _ArcVariates {
+  uint64_t flip;          // xor mask of the uniforms: ARC_UNIFORMS for the second sample of a pair
+  uint64_t point;         // index of the lattice point of the sample
+  uint64_t mask;          // number of lattice points - 1 (0 if none)
+  int shift;              // 53 - log2(number of lattice points)
+} ArcVariates;
+
+typedef struct _Rng {
+  uint64_t s[2];          // xoroshiro128+ state
+} Rng;
+
+static inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+   Hashes a (seed, key) pair into 64 random bits
+*/
+static inline uint64_t rng_hash(uint64_t seed, uint64_t key) {
+  return splitmix64(seed ^ splitmix64(key));
+}
+
+/**
+   Probability p scaled to the 53-bit range compared against by arc_coin()
+*/
+static inline uint64_t arc_threshold(double p) {
+  return (p >= 1.0) ? (1ULL << 53) : (uint64_t)(p * 9007199254740992.0);
+}
+
+/**
+   Coin of the i-th arc of provider u: true with probability threshold / 2^53;
+   the uniform is transformed by the variates v of the sample (all zero for
+   independent samples)
+*/
+static inline int arc_coin(uint64_t seed, int u, int i, uint64_t threshold, const ArcVariates *v) {
+  uint64_t h = rng_hash(seed, ((uint64_t)(uint32_t)u << 32) | (uint32_t)i);
+  if (!(v->mask | v->flip))
+    return (h >> 11) < threshold;
+  return ((((h >> 11) + (((v->point * (h | 1)) & v->mask) << v->shift)) & ARC_UNIFORMS) ^ v->flip) < threshold;
+}
+
+/**
+   Number of samples of the groups that share a seed under the variates
+   scheme, for the given number of samples: pairs of antithetic samples,
+   or lattices of a power of 2 points, at least VARIATES_LATTICE_GROUPS of
+   them if possible
+*/
+static inline int variates_group(Variates scheme, int samples) {
+  int group = 1;
+  if (scheme == VariatesAntithetic)
+    return 2;
+  if (scheme == VariatesLattice)
+    while (2 * group * VARIATES_LATTICE_GROUPS <= samples)
+      group *= 2;
+  return group;
+}
+
+/**
+   Seed of the arc coins of sample i (from 1) of epidemic j, in groups of
+   'group' samples that share the seed of their first sample, and sets the
+   variates v of the sample under the scheme. Independent samples (group
+   1) have the seeds of the key (j, i).
+*/
+static inline uint64_t arc_sample(uint64_t seed, int j, int i, Variates scheme, int group, ArcVariates *v) {
+  int first = (i - 1) / group * group + 1, log = 0;
+  v->flip = scheme == VariatesAntithetic && i > first ? ARC_UNIFORMS : 0;
+  v->point = scheme == VariatesLattice ? i - first : 0;
+  v->mask = scheme == VariatesLattice ? group - 1 : 0;
+  while ((1 << log) < group)
+    log++;
+  v->shift = 53 - log;
+  return rng_hash(seed, ((uint64_t)j << 32) | (uint32_t)first);
+}
+
+void rng_seed(Rng *r, uint64_t seed) {
+  r->s[0] = splitmix64(seed);
+  r->s[1] = splitmix64(r->s[0] ^ seed);
+  if (!(r->s[0] | r->s[1]))
+    r->s[1] = 1;
+}
+
+static inline uint64_t rng_next(Rng *r) {
+  uint64_t s0 = r->s[0], s1 = r->s[1], result = s0 + s1;
+  s1 ^= s0;
+  r->s[0] = ((s0 << 24) | (s0 >> 40)) ^ s1 ^ (s1 << 16);
+  r->s[1] = (s1 << 37) | (s1 >> 27);
+  return result;
+}
+
+/**
+   Uniform double in [0, 1)
+*/
+static inline double rng_uniform(Rng *r) {
+  return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+   Uniform integer in 0, ..., n-1, without modulo bias (Lemire's method)
+*/
+static inline uint64_t rng_below(Rng *r, uint64_t n) {
+  unsigned __int128 m = (unsigned __int128)rng_next(r) * n;
+  uint64_t low = (uint64_t)m, floor;
+  if (low < n) {
+    floor = -n % n;
+    while (low < floor) {
+      m = (unsigned __int128)rng_next(r) * n;
+      low = (uint64_t)m;
+    }
+  }
+  return (uint64_t)(m >> 64);
+}
+
+/**
+   Fisher-Yates shuffle of a[0], ..., a[n-1]
+*/
+void rng_fisher_yates(int *a, long n, Rng *r) {
+  long i, j;
+  int tmp;
+  for (i = n-1; i > 0; i--) {
+    j = rng_below(r, i+1);
+    tmp = a[i]; a[i] = a[j]; a[j] = tmp;
+  }
+}
+
+/**
+   Random interleaving of the shuffled halves a[0, mid) and a[mid, n),
+   giving a shuffled a[0, n) (merge step of MergeShuffle)
+*/
+void rng_merge(int *a, long mid, long n, Rng *r) {
+  long i = 0, j = mid, k;
+  uint64_t bits = 0;
+  int tmp, left = 0;
+  for (;; i++) {
+    if (!left) {
+      bits = rng_next(r);
+      left = 64;
+    }
+    left--;
+    if (bits & 1) {
+      if (j == n)
+	break;
+      tmp = a[i]; a[i] = a[j]; a[j] = tmp;
+      j++;
+    } else if (i == j)
+      break;
+    bits >>= 1;
+  }
+  for (; i < n; i++) {
+    k = rng_below(r, i+1);
+    tmp = a[i]; a[i] = a[k]; a[k] = tmp;
+  }
+}
+
+/**
+   Parallel uniform shuffle (MergeShuffle): blocks are shuffled independently,
+   then merged pairwise, level by level. Each block and merge has its own
+   stream derived from the seed, so the result only depends on seed and n.
+*/
+void rng_shuffle(int *a, long n, uint64_t seed) {
+  long b, blocks = 1, width;
+  while (blocks < 1024 && n / (2*blocks) >= 65536)
+    blocks *= 2;
+  width = (n + blocks - 1) / blocks;
+
+  #pragma omp parallel for schedule(dynamic,1)
+  for (b = 0; b < blocks; b++) {
+    Rng r;
+    long start = b * width < n ? b * width : n;
+    long end = start + width < n ? start + width : n;
+    rng_seed(&r, rng_hash(seed, b));
+    rng_fisher_yates(a + start, end - start, &r);
+  }
+  for (; width < n; width *= 2) {
+    #pragma omp parallel for schedule(dynamic,1)
+    for (b = 0; b < n; b += 2*width) {
+      Rng r;
+      long end = b + 2*width < n ? b + 2*width : n;
+      rng_seed(&r, rng_hash(seed ^ (uint64_t)width, b));
+      if (b + width < end)
+	rng_merge(a + b, width, end - b, &r);
+    }
+  }
+}
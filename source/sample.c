@@ -0,0 +1,188 @@
+/*
+  Trace sampling: uniform samples of at most N events of a stream of trace
+  events, kept in reservoirs with Li's Algorithm L, which draws how many
+  events to skip before the next one to keep, so that skipped events only
+  cost a counter increment. A sample may be stratified by time step (one
+  reservoir of N events per step), and samples of disjoint streams are
+  merged into a uniform sample of their union.
+*/
+
+typedef struct _SampledEvent {
+  Event e;                // event
+  int id;                 // epidemic id
+} SampledEvent;
+
+typedef struct _Reservoir {
+  long seen;              // events offered
+  long size;              // events held, at most the capacity
+  long next;              // rank (in seen) of the next event to keep
+  double w;               // largest key of the held events (Algorithm L)
+  SampledEvent *events;   // held events
+} Reservoir;
+
+typedef struct _TraceSample {
+  long capacity;          // max events per reservoir
+  int stratified;         // one reservoir per time step, or a single one
+  int num_strata;         // number of reservoirs
+  Reservoir *strata;      // reservoirs (by time step if stratified)
+  Rng rng;                // random choices of the sample
+} TraceSample;
+
+static inline double sample_open_uniform(Rng *rng) {
+  return ((rng_next(rng) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/**
+   Draws the rank of the next event to keep once the reservoir is full
+*/
+static inline void reservoir_skip(Reservoir *r, long capacity, Rng *rng) {
+  r->w *= exp(log(sample_open_uniform(rng)) / capacity);
+  r->next = r->seen + (long)floor(log(sample_open_uniform(rng)) / log1p(-r->w)) + 1;
+}
+
+TraceSample *trace_sample_new(long capacity, int stratified, uint64_t seed) {
+  TraceSample *s = (TraceSample *) calloc(1, sizeof(TraceSample));
+  assert(s != NULL);
+  assert(capacity > 0);
+  s->capacity = capacity;
+  s->stratified = stratified;
+  rng_seed(&s->rng, seed);
+  return s;
+}
+
+/**
+   Empties the sample, keeping its memory, and reseeds it
+*/
+void trace_sample_reset(TraceSample *s, uint64_t seed) {
+  int k;
+  for (k = 0; k < s->num_strata; k++)
+    s->strata[k].seen = s->strata[k].size = s->strata[k].next = 0;
+  rng_seed(&s->rng, seed);
+}
+
+void trace_sample_destroy(TraceSample *s) {
+  int k;
+  assert(s != NULL);
+  for (k = 0; k < s->num_strata; k++)
+    free(s->strata[k].events);
+  free(s->strata);
+  free(s);
+}
+
+static Reservoir *trace_sample_stratum(TraceSample *s, int k) {
+  if (k >= s->num_strata) {
+    s->strata = (Reservoir *) realloc(s->strata, (k+1) * sizeof(Reservoir));
+    assert(s->strata != NULL);
+    memset(s->strata + s->num_strata, 0, (k+1 - s->num_strata) * sizeof(Reservoir));
+    s->num_strata = k+1;
+  }
+  if (s->strata[k].events == NULL) {
+    s->strata[k].events = (SampledEvent *) malloc(s->capacity * sizeof(SampledEvent));
+    assert(s->strata[k].events != NULL);
+  }
+  return s->strata + k;
+}
+
+/**
+   Offers an event to the sample
+*/
+static inline void trace_sample_add(TraceSample *s, int t, int u, int v, int id) {
+  int k = s->stratified ? t : 0;
+  Reservoir *r = k < s->num_strata ? s->strata + k : trace_sample_stratum(s, k);
+  SampledEvent *x;
+  if (++r->seen < r->next)
+    return;
+  if (r->size < s->capacity) {
+    if (r->events == NULL)
+      trace_sample_stratum(s, k);
+    x = r->events + r->size++;
+    if (r->size == s->capacity) {
+      r->w = 1;
+      reservoir_skip(r, s->capacity, &s->rng);
+    }
+  } else {
+    x = r->events + rng_below(&s->rng, s->capacity);
+    reservoir_skip(r, s->capacity, &s->rng);
+  }
+  x->e.t = t;
+  x->e.provider = u;
+  x->e.client = v;
+  x->id = id;
+}
+
+/**
+   Merges the sample 'from' of a disjoint stream into 'into', which becomes
+   a uniform sample of both streams: the number of events taken from each
+   one follows the hypergeometric law of a uniform draw from their union.
+   Merged samples take no further events (only further merges).
+*/
+void trace_sample_merge(TraceSample *into, TraceSample *from) {
+  int k;
+  long a, b, m, remaining_a, remaining_b, i, j;
+  Reservoir *r, *q;
+  SampledEvent *merged, swap;
+
+  for (k = 0; k < from->num_strata; k++) {
+    q = from->strata + k;
+    if (q->seen == 0)
+      continue;
+    r = trace_sample_stratum(into, k);
+    m = r->seen + q->seen < into->capacity ? r->seen + q->seen : into->capacity;
+    merged = (SampledEvent *) malloc(into->capacity * sizeof(SampledEvent));
+    assert(merged != NULL);
+    // partial Fisher-Yates draws from each reservoir, in hypergeometric proportions
+    remaining_a = r->seen;
+    remaining_b = q->seen;
+    a = b = 0;
+    for (i = 0; i < m; i++)
+      if (rng_below(&into->rng, remaining_a + remaining_b) < (uint64_t)remaining_a) {
+	j = a + rng_below(&into->rng, r->size - a);
+	swap = r->events[a]; r->events[a] = r->events[j]; r->events[j] = swap;
+	merged[i] = r->events[a++];
+	remaining_a--;
+      } else {
+	j = b + rng_below(&into->rng, q->size - b);
+	swap = q->events[b]; q->events[b] = q->events[j]; q->events[j] = swap;
+	merged[i] = q->events[b++];
+	remaining_b--;
+      }
+    free(r->events);
+    r->events = merged;
+    r->size = m;
+    r->seen += q->seen;
+  }
+}
+
+static int sampled_event_compare(const void *a, const void *b) {
+  const SampledEvent *x = (const SampledEvent *) a, *y = (const SampledEvent *) b;
+  if (x->id != y->id)
+    return x->id < y->id ? -1 : 1;
+  return event_compare(&x->e, &y->e);
+}
+
+/**
+   Writes the sampled events of all strata in (F, t, P, C) order and empties
+   the sample; with an index, callers must serialize the calls. Returns the
+   number of events written; *seen is increased by the number of events
+   offered.
+*/
+long trace_sample_write(TraceSample *s, FILE *output, TraceIndex *index, long *seen) {
+  int k;
+  long i, size = 0;
+  SampledEvent *events;
+  for (k = 0; k < s->num_strata; k++)
+    size += s->strata[k].size;
+  events = (SampledEvent *) malloc((size > 0 ? size : 1) * sizeof(SampledEvent));
+  assert(events != NULL);
+  for (k = 0, size = 0; k < s->num_strata; k++) {
+    memcpy(events + size, s->strata[k].events, s->strata[k].size * sizeof(SampledEvent));
+    size += s->strata[k].size;
+    *seen += s->strata[k].seen;
+    s->strata[k].seen = s->strata[k].size = s->strata[k].next = 0;
+  }
+  qsort(events, size, sizeof(SampledEvent), sampled_event_compare);
+  for (i = 0; i < size; i++)
+    trace_write(output, index, &events[i].e, events[i].id);
+  free(events);
+  return size;
+}
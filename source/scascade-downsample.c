@@ -0,0 +1,151 @@
+/*
+  GRAPH DOWNSAMPLING:
+  Writes a smaller graph in the input format of scascade, induced by the
+  nodes picked by a forest fire, a snowball or induced edge sampling, with
+  the map of its node ids to the original ones, and compares the degree
+  distribution and clustering of the sample with those of the graph.
+*/
+
+#define _GNU_SOURCE // fopencookie, open_memstream
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <omp.h>
+
+#include "prelim.c"
+#include "random.c"
+#include "preprocess.c"
+#include "input.c"
+#include "frontier.c"
+#include "downsample.c"
+
+#define MAX_PATH_LENGTH 4096
+
+char *sampler_description[] = {"forest-fire", "snowball", "induced"};
+
+static void profile_print(const char *name, GraphProfile *p) {
+  int b, bins;
+  fprintf(stderr, "  %-8s %10d nodes %12ld links, mean degree %.2f, max degree %d, clustering %.4f\n",
+	  name, p->n, p->m, p->n ? 2.0 * p->m / p->n : 0.0, p->max_degree, p->clustering);
+  for (bins = DOWNSAMPLE_BINS; bins > 1 && p->degrees[bins-1] == 0; bins--)
+    ;
+  fprintf(stderr, "  %-8s degrees 0, 1, 2-3, 4-7, ... (%%):", name);
+  for (b = 0; b < bins; b++)
+    fprintf(stderr, " %.2f", p->n ? 100.0 * p->degrees[b] / p->n : 0.0);
+  fputc('\n', stderr);
+}
+
+int main(int argc, char **argv) {
+  int i, u, limit = 0, *map;
+  uint64_t seed = (uint64_t)time(NULL);
+  double size = 0.01, burn = 0.7, start;
+  long k, fires = 0;
+  size_t text_size;
+  char *output_path = NULL, *text, *kept, path[MAX_PATH_LENGTH];
+  Sampler sampler = SamplerForestFire;
+  PrepReport report = {0, 0, 0};
+  GraphProfile before, after;
+  graph *g, *s;
+  FILE *output;
+  char syntax[] = "\n Usage: scascade-downsample [options] -o OUTPUT_PREFIX GRAPH_PATH\n Optional parameters:\n\
+\t -m forest-fire|snowball|induced\n\t -n SIZE (fraction of the nodes, or number of nodes)\n\
+\t -p BURNING_PROBABILITY (forest fire)\n\t -k NEIGHBORS (snowball, 0 for all)\n\t -r RANDOM_SEED\n\t -h NUM_THREADS\n\n";
+
+  while ((i = getopt(argc, argv, "m:n:p:k:r:o:h:")) != -1)
+    switch (i) {
+    case 'm':
+      for (sampler = SamplerForestFire; sampler <= SamplerInduced; sampler++)
+	if (strcmp(optarg, sampler_description[sampler]) == 0)
+	  break;
+      if (sampler > SamplerInduced)
+	report_error("scascade-downsample: unknown sampler");
+      break;
+    case 'n':
+      size = atof(optarg);
+      break;
+    case 'p':
+      burn = atof(optarg);
+      break;
+    case 'k':
+      limit = atoi(optarg);
+      break;
+    case 'r':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'o':
+      output_path = optarg;
+      break;
+    case 'h':
+      omp_set_num_threads(atoi(optarg));
+      break;
+    case '?':
+      fputs(syntax, stderr);
+    default:
+      abort();
+    }
+  if (optind != argc-1 || !output_path || size <= 0 || limit < 0
+      || (sampler == SamplerForestFire && (burn <= 0 || burn >= 1))) {
+    fputs(syntax, stderr);
+    return 1;
+  }
+
+  // the graph, undirected and clean
+  start = omp_get_wtime();
+  text = input_load(argv[optind], &text_size, &k);
+  g = graph_from_text(text, text_size, 0);
+  free(text);
+  graph_clean(g, &report);
+  fprintf(stderr, "Loaded the graph with %d nodes, %d links in %.2fs (removed %ld self-loop and %ld duplicate arcs).\n",
+	  g->n, g->m, omp_get_wtime() - start, report.self_loops, report.duplicates);
+
+  // the sample
+  start = omp_get_wtime();
+  k = size < 1 ? (long)(size * g->n + 0.5) : (long)size;
+  if (k > g->n)
+    k = g->n;
+  kept = (char *) malloc(g->n > 0 ? g->n : 1);
+  assert(kept != NULL);
+  if (k == g->n)
+    memset(kept, 1, g->n);
+  else if (sampler == SamplerInduced)
+    downsample_induced(g, k, seed, kept);
+  else
+    fires = downsample_spread(g, sampler, k, burn, limit, seed, kept);
+  s = downsample_induce(g, kept, &map);
+  fprintf(stderr, "Sampled %d nodes (%s, random seed %llu", s->n, sampler_description[sampler],
+	  (unsigned long long)seed);
+  if (fires)
+    fprintf(stderr, ", %ld %s", fires, sampler == SamplerSnowball ? "snowballs" : "fires");
+  fprintf(stderr, ") in %.2fs.\n", omp_get_wtime() - start);
+
+  // the sample graph and its map
+  start = omp_get_wtime();
+  sprintf(path, "%s.graph", output_path);
+  if ((output = fopen(path, "w")) == NULL)
+    report_error("scascade-downsample: cannot open the graph output");
+  downsample_write(s, output);
+  fclose(output);
+  sprintf(path, "%s.map", output_path);
+  if ((output = fopen(path, "w")) == NULL)
+    report_error("scascade-downsample: cannot open the map output");
+  for (u = 0; u < s->n; u++)
+    fprintf(output, "%d %d\n", u, map[u]);
+  fclose(output);
+  fprintf(stderr, "Wrote %s.graph and %s.map in %.2fs.\n\n", output_path, output_path, omp_get_wtime() - start);
+
+  downsample_profile(g, seed, &before);
+  downsample_profile(s, seed, &after);
+  profile_print("graph", &before);
+  profile_print("sample", &after);
+
+  free(map);
+  free(kept);
+  free_graph(s);
+  free_graph(g);
+  return 0;
+}
@@ -0,0 +1,169 @@
+/*
+  SPREADING TRACE QUERY:
+  Extracts or counts the events of chosen epidemics and time steps from a
+  trace written by scascade with an index ('-x'), seeking to the indexed
+  blocks instead of scanning the whole trace.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include "prelim.c"
+#include "trace.c"
+
+#define MAX_PATH_LENGTH 4096
+#define QUERY_BATCH (64L << 20) // bytes copied in parallel before each write
+
+/**
+   Reads the index of the trace at path; returns the number of entries
+*/
+long index_import(const char *path, TraceIndexEntry **entries) {
+  char index_path[MAX_PATH_LENGTH], magic[8];
+  FILE *input;
+  long size, n;
+  snprintf(index_path, MAX_PATH_LENGTH, "%s.idx", path);
+  input = fopen(index_path, "rb");
+  if (input == NULL)
+    report_error("index_import: cannot open the index (run scascade with '-x')");
+  if (fread(magic, 1, 8, input) != 8 || memcmp(magic, TRACE_INDEX_MAGIC, 8))
+    report_error("index_import: not a trace index");
+  fseek(input, 0, SEEK_END);
+  size = ftell(input) - 8;
+  fseek(input, 8, SEEK_SET);
+  n = size / sizeof(TraceIndexEntry);
+  *entries = (TraceIndexEntry *) malloc((n > 0 ? n : 1) * sizeof(TraceIndexEntry));
+  assert(*entries != NULL);
+  if ((long)fread(*entries, sizeof(TraceIndexEntry), n, input) != n)
+    report_error("index_import: read error");
+  fclose(input);
+  return n;
+}
+
+static int pair_compare(const void *a, const void *b) {
+  const long *x = (const long *) a, *y = (const long *) b;
+  return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+/**
+   Writes the selected blocks in trace order; blocks are copied in parallel
+   from the mapped trace into a batch buffer, which is then written out
+*/
+void blocks_extract(char *trace, long trace_size, TraceIndexEntry *entries, long num_entries,
+		    long *selected, long n, FILE *output) {
+  long first, last, k, *length, *start, bytes;
+  char *batch;
+  length = (long *) malloc((n > 0 ? n : 1) * sizeof(long));
+  start = (long *) malloc((n+1) * sizeof(long));
+  batch = (char *) malloc(QUERY_BATCH);
+  assert(length != NULL && start != NULL && batch != NULL);
+  // a block ends where the next indexed block (or the trace) starts
+  for (k = 0; k < n; k++)
+    length[k] = (selected[k]+1 < num_entries ? entries[selected[k]+1].offset : trace_size)
+      - entries[selected[k]].offset;
+
+  for (first = 0; first < n; first = last) {
+    if (length[first] > QUERY_BATCH) { // a single block larger than a batch
+      fwrite(trace + entries[selected[first]].offset, 1, length[first], output);
+      last = first+1;
+      continue;
+    }
+    start[first] = bytes = 0;
+    for (last = first; last < n && bytes + length[last] <= QUERY_BATCH; last++)
+      start[last+1] = bytes += length[last];
+    #pragma omp parallel for schedule(dynamic,16)
+    for (k = first; k < last; k++)
+      memcpy(batch + start[k], trace + entries[selected[k]].offset, length[k]);
+    fwrite(batch, 1, bytes, output);
+  }
+  free(batch);
+  free(start);
+  free(length);
+}
+
+int main(int argc, char **argv) {
+  int i, num_ids = 0, count = 0, tmin = INT_MIN, tmax = INT_MAX, fd;
+  long b, n, num_selected = 0, events = 0, *selected, *counts;
+  char *id_list = NULL, *trace;
+  TraceIndexEntry *entries;
+  Range *ids = NULL;
+  struct stat st;
+  char syntax[] = "\n Usage: scascade-query [options] TRACE_PATH\n Optional parameters:\n\
+\t -f EPIDEMIC_IDS (e.g. 0,3,10-20)\n\t -t [FIRST_TIME]:[LAST_TIME]\n\t -c (count events per epidemic)\n\t -h NUM_THREADS\n\n";
+
+  while ((i = getopt(argc, argv, "f:t:ch:")) != -1)
+    switch (i) {
+    case 'f':
+      id_list = optarg;
+      break;
+    case 't':
+      time_range_parse(optarg, &tmin, &tmax);
+      break;
+    case 'c':
+      count = 1;
+      break;
+    case 'h':
+      omp_set_num_threads(atoi(optarg));
+      break;
+    case '?':
+      fputs(syntax, stderr);
+    default:
+      abort();
+    }
+  if (optind != argc-1) {
+    fputs(syntax, stderr);
+    return 1;
+  }
+  if (id_list)
+    num_ids = ranges_parse(id_list, &ids);
+
+  // select the blocks
+  n = index_import(argv[optind], &entries);
+  selected = (long *) malloc((n > 0 ? n : 1) * sizeof(long));
+  assert(selected != NULL);
+  for (b = 0; b < n; b++)
+    if (tmin <= entries[b].t && entries[b].t <= tmax && ranges_contain(ids, num_ids, entries[b].id)) {
+      selected[num_selected++] = b;
+      events += entries[b].count;
+    }
+
+  if (count) {
+    // sort the selected blocks' counts by epidemic id
+    counts = (long *) malloc((num_selected > 0 ? num_selected : 1) * 2 * sizeof(long));
+    assert(counts != NULL);
+    for (b = 0; b < num_selected; b++) {
+      counts[2*b] = entries[selected[b]].id;
+      counts[2*b+1] = entries[selected[b]].count;
+    }
+    qsort(counts, num_selected, 2 * sizeof(long), pair_compare);
+    for (b = 0; b < num_selected; b++)
+      if (b+1 == num_selected || counts[2*b] != counts[2*b+2])
+	printf("%ld %ld\n", counts[2*b], counts[2*b+1]);
+      else
+	counts[2*b+3] += counts[2*b+1];
+    fprintf(stderr, "%ld events in %ld blocks\n", events, num_selected);
+    free(counts);
+  } else if (num_selected > 0) {
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+      report_error("scascade-query: cannot open the trace");
+    trace = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (trace == MAP_FAILED)
+      report_error("scascade-query: cannot map the trace");
+    blocks_extract(trace, st.st_size, entries, n, selected, num_selected, stdout);
+    munmap(trace, st.st_size);
+    close(fd);
+  }
+
+  free(ids);
+  free(selected);
+  free(entries);
+  return 0;
+}
@@ -0,0 +1,219 @@
+/*
+  SNAPSHOT QUERY:
+  Lists the infected sets written by scascade with '--snapshots', or
+  combines them across sample epidemics by union or intersection, working
+  on the compressed bitmaps directly.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include "prelim.c"
+#include "trace.c"
+#include "bitmap.c"
+#include "snapshot.c"
+
+typedef struct _Snapshot {
+  SnapshotRecord r;       // record header
+  const char *bitmap;     // serialized bitmap, in the mapped file
+} Snapshot;
+
+/**
+   Reads the record headers of the mapped snapshot file; returns the number
+   of records
+*/
+long snapshot_import(const char *map, long size, int *nodes, Snapshot **snapshots) {
+  long n = 0, capacity = 1024, offset = 8 + sizeof(int32_t);
+  int32_t num_nodes;
+  if (size < offset || memcmp(map, SNAPSHOT_MAGIC, 8))
+    report_error("snapshot_import: not a snapshot file");
+  memcpy(&num_nodes, map + 8, sizeof(int32_t));
+  *nodes = num_nodes;
+  *snapshots = (Snapshot *) malloc(capacity * sizeof(Snapshot));
+  assert(*snapshots != NULL);
+  while (offset + (long)sizeof(SnapshotRecord) <= size) {
+    if (n == capacity) {
+      capacity *= 2;
+      *snapshots = (Snapshot *) realloc(*snapshots, capacity * sizeof(Snapshot));
+      assert(*snapshots != NULL);
+    }
+    memcpy(&(*snapshots)[n].r, map + offset, sizeof(SnapshotRecord));
+    offset += sizeof(SnapshotRecord);
+    if ((*snapshots)[n].r.bytes < 0 || offset + (*snapshots)[n].r.bytes > size)
+      break; // truncated record
+    (*snapshots)[n++].bitmap = map + offset;
+    offset += (*snapshots)[n-1].r.bytes;
+  }
+  if (offset != size)
+    fprintf(stderr, "Warning: the snapshot file is truncated after %ld records.\n", n);
+  return n;
+}
+
+static Bitmap *snapshot_bitmap(Snapshot *s, int n) {
+  Bitmap *b = bitmap_deserialize(s->bitmap, s->r.bytes, n);
+  if (b == NULL)
+    report_error("snapshot_bitmap: malformed bitmap");
+  return b;
+}
+
+/**
+   Orders snapshots by epidemic, time (final sets last), then sample
+*/
+static int snapshot_compare(const void *a, const void *b) {
+  const SnapshotRecord *x = &((const Snapshot *) a)->r, *y = &((const Snapshot *) b)->r;
+  unsigned tx = x->t == SNAPSHOT_END ? ~0U : (unsigned)x->t, ty = y->t == SNAPSHOT_END ? ~0U : (unsigned)y->t;
+  if (x->id != y->id)
+    return x->id < y->id ? -1 : 1;
+  if (tx != ty)
+    return tx < ty ? -1 : 1;
+  return (x->sample > y->sample) - (x->sample < y->sample);
+}
+
+static void time_print(int t) {
+  if (t == SNAPSHOT_END)
+    printf("end");
+  else
+    printf("%d", t);
+}
+
+int main(int argc, char **argv) {
+  int i, fd, n, num_ids = 0, num_samples = 0, num_times = 0, combine = 0, all = 0, list = 0, *nodes;
+  long k, num_snapshots, num_selected = 0, num_groups = 0, *group, size;
+  char *id_list = NULL, *sample_list = NULL, *time_list = NULL, *map;
+  Range *ids = NULL, *samples = NULL, *times = NULL;
+  Snapshot *snapshots, *selected;
+  Bitmap **results;
+  struct stat st;
+  char syntax[] = "\n Usage: scascade-snap [options] SNAPSHOT_PATH\n Optional parameters:\n\
+\t -f EPIDEMIC_IDS (e.g. 0,3,10-20)\n\t -s SAMPLES (e.g. 1-100)\n\t -t TIMES (e.g. 1,5,10-20,end)\n\
+\t -u (union across samples)\n\t -i (intersection across samples)\n\t -a (combine all the selected sets)\n\
+\t -l (list nodes)\n\t -h NUM_THREADS\n\n";
+
+  while ((i = getopt(argc, argv, "f:s:t:uialh:")) != -1)
+    switch (i) {
+    case 'f':
+      id_list = optarg;
+      break;
+    case 's':
+      sample_list = optarg;
+      break;
+    case 't':
+      time_list = optarg;
+      break;
+    case 'u':
+      combine = 'u';
+      break;
+    case 'i':
+      combine = 'i';
+      break;
+    case 'a':
+      all = 1;
+      break;
+    case 'l':
+      list = 1;
+      break;
+    case 'h':
+      omp_set_num_threads(atoi(optarg));
+      break;
+    case '?':
+      fputs(syntax, stderr);
+    default:
+      abort();
+    }
+  if (optind != argc-1 || (all && !combine)) {
+    fputs(syntax, stderr);
+    return 1;
+  }
+  if (id_list)
+    num_ids = ranges_parse(id_list, &ids);
+  if (sample_list)
+    num_samples = ranges_parse(sample_list, &samples);
+  if (time_list) // 'end' reads as 0, the time of the final sets
+    num_times = ranges_parse(time_list, &times);
+
+  fd = open(argv[optind], O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0)
+    report_error("scascade-snap: cannot open the snapshot file");
+  map = (char *) mmap(NULL, st.st_size > 0 ? st.st_size : 1, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    report_error("scascade-snap: cannot map the snapshot file");
+  num_snapshots = snapshot_import(map, st.st_size, &n, &snapshots);
+
+  // select the snapshots, grouped by epidemic and time unless all are combined
+  selected = (Snapshot *) malloc((num_snapshots > 0 ? num_snapshots : 1) * sizeof(Snapshot));
+  group = (long *) malloc((num_snapshots + 1) * sizeof(long));
+  assert(selected != NULL && group != NULL);
+  for (k = 0; k < num_snapshots; k++)
+    if (ranges_contain(ids, num_ids, snapshots[k].r.id) && ranges_contain(samples, num_samples, snapshots[k].r.sample)
+	&& ranges_contain(times, num_times, snapshots[k].r.t))
+      selected[num_selected++] = snapshots[k];
+  qsort(selected, num_selected, sizeof(Snapshot), snapshot_compare);
+  for (k = 0; k < num_selected; k++)
+    if (k == 0 || (combine && !all && (selected[k].r.id != selected[k-1].r.id || selected[k].r.t != selected[k-1].r.t))
+	|| !combine)
+      group[num_groups++] = k;
+  group[num_groups] = num_selected;
+
+  // combine each group, in parallel
+  results = (Bitmap **) calloc(num_groups > 0 ? num_groups : 1, sizeof(Bitmap *));
+  assert(results != NULL);
+  #pragma omp parallel for schedule(dynamic,1) private(k)
+  for (i = 0; i < num_groups; i++) {
+    Bitmap *b, *c;
+    results[i] = snapshot_bitmap(selected + group[i], n);
+    for (k = group[i]+1; k < group[i+1]; k++) {
+      if (combine == 'i' && results[i]->size == 0)
+	break;
+      b = snapshot_bitmap(selected + k, n);
+      c = combine == 'u' ? bitmap_or(results[i], b) : bitmap_and(results[i], b);
+      bitmap_destroy(b);
+      bitmap_destroy(results[i]);
+      results[i] = c;
+    }
+  }
+
+  // one line per set: F [sample] t count [sets], or one line per node: F [sample] t node
+  nodes = (int *) malloc((n > 0 ? n : 1) * sizeof(int));
+  assert(nodes != NULL);
+  for (i = 0; i < num_groups; i++) {
+    Snapshot *s = selected + group[i];
+    size = list ? bitmap_to_nodes(results[i], nodes, n) : 1;
+    for (k = 0; k < size; k++) {
+      if (all)
+	printf("all");
+      else {
+	printf("%d ", s->r.id);
+	if (!combine)
+	  printf("%d ", s->r.sample);
+	time_print(s->r.t);
+      }
+      if (list)
+	printf(" %d\n", nodes[k]);
+      else if (combine)
+	printf(" %ld %ld\n", bitmap_cardinality(results[i]), group[i+1] - group[i]);
+      else
+	printf(" %ld\n", bitmap_cardinality(results[i]));
+    }
+    bitmap_destroy(results[i]);
+  }
+  fprintf(stderr, "%ld of %ld snapshots selected in %ld sets\n", num_selected, num_snapshots, num_groups);
+
+  munmap(map, st.st_size > 0 ? st.st_size : 1);
+  close(fd);
+  free(nodes);
+  free(results);
+  free(group);
+  free(selected);
+  free(snapshots);
+  free(ids);
+  free(samples);
+  free(times);
+  return 0;
+}
@@ -7,32 +7,61 @@
   Daniel.Bernardes@lip6.fr, 2011
 */
 
+#define _GNU_SOURCE // fopencookie
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <time.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
 #include <dirent.h>
+#include <signal.h>
+#include <math.h>
 #include <omp.h>
 
 #include "prelim.c"
-#include "queue.c"
+#include "random.c"
+#include "preprocess.c"
+#include "input.c"
+#include "frontier.c"
+#include "trace.c"
+#include "sample.c"
+#include "bitmap.c"
+#include "snapshot.c"
+#include "metrics.c"
+#include "load.c"
+#include "stats.c"
 
 // misc defs and utils
 #define VERBOSE 1
 #define PARALLEL 1
 #define MAX_PATH_LENGTH 4096
+#define TEAM_THRESHOLD 4096 // default frontier size promoting a level to the thread team
+#define TEAM_CHUNK 256      // frontier nodes expanded per task of a team level
+#define EVENT_BUFFER 1024   // trace events buffered per task of a team level
+
+int team_threshold = TEAM_THRESHOLD; // 0 disables intra-epidemic parallelism
+volatile sig_atomic_t interrupted = 0; // signal number once SIGINT or SIGTERM is received
 
-inline char *tstamp() {
+/**
+   Asks all epidemics to stop at their next time step; a second signal
+   terminates the program
+*/
+static void on_signal(int sig) {
+  interrupted = sig;
+}
+
+static inline char *tstamp() {
   time_t now = time(NULL);
   char *str = asctime(localtime(&now));
   str[strlen(str)-1]=' ';
   return str;
 }
 
-inline void techo(char *str) {
+static inline void techo(char *str) {
 #if VERBOSE > 1
   #if PARALLEL
     fprintf(stdout, "%s -- Thread %d -- %s\n",
@@ -45,8 +74,11 @@ inline void techo(char *str) {
 }
 
 // Epidemic management
-typedef enum _Stop_criterion {MaxTime, NumInfected} Stopc;
-const char *stopc_description[] = {"maxdepth","maxsize"};
+typedef enum _Stop_criterion {MaxTime, NumInfected, FracInfected, MaxTimeSize} Stopc;
+const char *stopc_description[] = {"maxdepth","maxsize","maxfraction","maxdepthsize"};
+typedef enum _Truncation {Complete, Budget, Interrupted} Truncation;
+const char *truncation_description[] = {"", " (truncated: time budget)", " (truncated: interrupted)"};
+const char *variance_description[] = {"", "antithetic", "rqmc", "control"};
 
 typedef struct _InitialCondition {
   int id;                 // epidemic id
@@ -54,43 +86,168 @@ typedef struct _InitialCondition {
   int *infected;          // list of infected nodes' id
   int bound;              // bounds on epidemic evolution in terms of a ...
   Stopc stop_criterion;   // ... e.g., max time or max num infected)
+  int max_time;           // with MaxTimeSize, the bound on time (bound is on size)
+  int num_bounds;         // number of bounds of a bound list, 0 if a single bound
+  int *bounds;            // bound list, increasing, ending with bound (NULL if none)
+  double p;               // spreading probability, 0 for the global one (-p)
 } InitialCondition;
 
+typedef struct _BoundResult {
+  int t;                  // time steps elapsed when the bound was met
+  int num_infected;       // number of infected nodes
+  int cascade_links;      // number of arcs in the infection cascade
+} BoundResult;
+
+/**
+   Last time step spread by the epidemic of ic (INT_MAX if unbounded)
+*/
+static inline int ic_max_time(InitialCondition *ic) {
+  return ic->stop_criterion == MaxTime ? ic->bound : (ic->stop_criterion == MaxTimeSize ? ic->max_time : INT_MAX);
+}
+
+/**
+   Number of infected nodes that stops the epidemic of ic (INT_MAX if unbounded)
+*/
+static inline int ic_max_infected(InitialCondition *ic) {
+  return ic->stop_criterion == MaxTime ? INT_MAX : ic->bound;
+}
+
 typedef struct _Epidemic {
   int id;                 // epidemic id
   int t;                  // time steps elapsed
   int num_infected;       // number of currently infected nodes
   int cascade_links;      // number of arcs in the infection cascade
-  int bound;              // bounds on epidemic evolution in terms of ...
-  Stopc stop_criterion;   // ... e.g., max time or max num infected
+  int max_time;           // last time step spread (INT_MAX if unbounded)
+  int max_infected;       // number of infected nodes that stops it (INT_MAX if unbounded)
+  int *bounds;            // if set, bound list of the epidemic (see InitialCondition)
+  int num_bounds;         // number of bounds in the list
+  int next_bound;         // first bound of the list not met yet
+  int next_infected;      // number of infected nodes of the next size bound (max_infected if no list)
+  BoundResult *bound_results; // state of the epidemic when each bound of the list was met
+  FILE **bound_outputs;   // if set, trace output of each bound of the list
   double p;               // neighbor infection probability
+  uint64_t threshold;     // p scaled for arc_coin()
+  uint64_t seed;          // seed of the arc coins of this epidemic
+  ArcVariates variates;   // transform of their uniforms for this sample (see arc_sample)
   graph *g;               // underlying graph (network)
   FILE *output;           // trace output
-  int *infected;          // set of all infected nodes
-  Queue *active;          // list of active infected nodes
+  TraceBuffer *buffer;    // if set, trace events held until the end of the epidemic
+  TraceIndex *index;      // if set, index of the trace output
+  TraceFilter *filter;    // if set, events kept in the trace output
+  TraceSample *sample;    // if set, trace events sampled instead of written
+  SnapshotOutput *snapshots; // if set, infected sets written at chosen times
+  CascadeStats *stats;    // if set, cascade structure counted per time step
+  int sample_number;      // number of the sample epidemic run, from 1
+  int tracing;            // whether events of the current level may be traced
+  double deadline;        // if non-zero, wall-clock time (omp_get_wtime) to stop at
+  Truncation truncated;   // whether and why the epidemic was stopped early
+  int *infected;          // set of all infected nodes (time of infection, 0 if not)
+  int *touched;           // infected nodes of the completed levels, by level
+  int num_touched;        // number of nodes in touched
+  Frontier *active;       // active infected nodes: current and next level
 } Epidemic;
 
-Epidemic *epidemic_new(double p, graph *g, InitialCondition *ic, FILE *output) {
+/**
+   Records the state of the epidemic for the first bound of its list not
+   met yet, which is met. Returns 1 if it is the last bound, or if the
+   epidemic has no bound list: its run is then over.
+*/
+static inline int epidemic_bound_met(Epidemic *epidemic) {
+  BoundResult *result;
+  if (!epidemic->bounds)
+    return 1;
+  result = epidemic->bound_results + epidemic->next_bound;
+  result->t = epidemic->t;
+  result->num_infected = epidemic->num_infected;
+  result->cascade_links = epidemic->cascade_links;
+  if (++epidemic->next_bound == epidemic->num_bounds)
+    return 1;
+  if (epidemic->max_infected != INT_MAX)
+    epidemic->next_infected = epidemic->bounds[epidemic->next_bound];
+  return 0;
+}
+
+/**
+   Sets the spreading probability of an epidemic workspace
+*/
+static inline void epidemic_set_p(Epidemic *epidemic, double p) {
+  epidemic->p = p;
+  epidemic->threshold = arc_threshold(p);
+}
+
+/**
+   Restarts the epidemic from the initial condition ic with new arc coins,
+   reusing its memory: only the nodes infected so far are cleared; its
+   spreading probability is left unchanged (see epidemic_set_p)
+*/
+void epidemic_restart(Epidemic *epidemic, InitialCondition *ic, uint64_t seed) {
   int i;
-  Epidemic *epidemic = (Epidemic *) malloc(sizeof(Epidemic));
-  assert(epidemic != NULL);
+  Frontier *active = epidemic->active;
   assert(ic != NULL);
+  for (i = 0; i < epidemic->num_touched; i++)
+    epidemic->infected[epidemic->touched[i]] = 0;
+  for (i = 0; i < active->next_size; i++)
+    epidemic->infected[active->next[i]] = 0;
+  active->size = active->next_size = 0;
+  epidemic->num_touched    = 0;
   epidemic->id             = ic->id;
   epidemic->t              = 1;
-  epidemic->num_infected   = ic->num_infected;
   epidemic->cascade_links  = 0;
-  epidemic->bound          = ic->bound;
-  epidemic->stop_criterion = ic->stop_criterion;
+  epidemic->max_time       = ic_max_time(ic);
+  epidemic->max_infected   = ic_max_infected(ic);
+  epidemic->bounds         = ic->num_bounds > 1 ? ic->bounds : NULL;
+  epidemic->num_bounds     = ic->num_bounds;
+  epidemic->next_bound     = 0;
+  epidemic->next_infected  = epidemic->max_infected;
+  epidemic->seed           = seed;
+  epidemic->truncated      = Complete;
+  for (i = 0; i < ic->num_infected; i++)
+    if (!epidemic->infected[ic->infected[i]]) {
+      frontier_add(active, ic->infected[i]);
+      epidemic->infected[ic->infected[i]] = 1; // the initial time;
+      epidemic->touched[epidemic->num_touched++] = ic->infected[i];
+    }
+  epidemic->num_infected   = epidemic->num_touched; // repeated initial nodes count once
+  frontier_swap(active);
+  if (epidemic->bounds) {
+    epidemic->bound_results = (BoundResult *) realloc(epidemic->bound_results,
+						      epidemic->num_bounds * sizeof(BoundResult));
+    assert(epidemic->bound_results != NULL);
+    if (epidemic->max_infected != INT_MAX) {
+      // size bounds met from the start
+      while (epidemic->next_bound < epidemic->num_bounds - 1
+	     && epidemic->bounds[epidemic->next_bound] <= epidemic->num_infected)
+	epidemic_bound_met(epidemic);
+      epidemic->next_infected = epidemic->bounds[epidemic->next_bound];
+    }
+  }
+}
+
+Epidemic *epidemic_new(double p, graph *g, InitialCondition *ic, FILE *output, uint64_t seed) {
+  Epidemic *epidemic = (Epidemic *) malloc(sizeof(Epidemic));
+  assert(epidemic != NULL);
   epidemic->p              = p;
+  epidemic->threshold      = arc_threshold(p);
   epidemic->g              = g;
   epidemic->output         = output;
-  epidemic->active         = queue_new(g->n);
+  epidemic->buffer         = NULL;
+  epidemic->index          = NULL;
+  epidemic->filter         = NULL;
+  epidemic->sample         = NULL;
+  epidemic->snapshots      = NULL;
+  epidemic->stats          = NULL;
+  epidemic->bound_results  = NULL;
+  epidemic->bound_outputs  = NULL;
+  memset(&epidemic->variates, 0, sizeof(ArcVariates));
+  epidemic->sample_number  = 1;
+  epidemic->tracing        = 0;
+  epidemic->deadline       = 0;
+  epidemic->active         = frontier_new(g->n);
   epidemic->infected       = (int *) calloc(g->n, sizeof(int));
-  assert(epidemic->infected != NULL);
-  for (i = 0; i < ic->num_infected; i++) {
-    queue_add(epidemic->active, ic->infected[i]);
-    epidemic->infected[ic->infected[i]] = 1; // the initial time;
-  }
+  epidemic->touched        = (int *) calloc(g->n + 1, sizeof(int));
+  assert(epidemic->infected != NULL && epidemic->touched != NULL);
+  epidemic->num_touched    = 0;
+  epidemic_restart(epidemic, ic, seed);
   return epidemic;
 }
 
@@ -98,49 +255,316 @@ void epidemic_destroy(Epidemic *epidemic) {
   assert(epidemic != NULL);
   epidemic->g = NULL; // don't destroy the graph, since it's shared a structure generally
   free(epidemic->infected);
-  queue_destroy(epidemic->active);
+  free(epidemic->touched);
+  free(epidemic->bound_results);
+  frontier_destroy(epidemic->active);
   free(epidemic);
   epidemic = NULL;
 }
 
+static inline void epidemic_record(Epidemic *epidemic, int t, int u, int v) {
+  int k;
+  if (epidemic->sample)
+    trace_sample_add(epidemic->sample, t, u, v, epidemic->id);
+  else if (epidemic->buffer)
+    trace_buffer_add(epidemic->buffer, t, u, v);
+  else if (epidemic->index) {
+    #pragma omp critical (epidemic_output)
+    trace_print(epidemic->output, epidemic->index, t, u, v, epidemic->id);
+  } else if (epidemic->bound_outputs) { // in the trace of every bound not met yet
+    for (k = epidemic->next_bound; k < epidemic->num_bounds; k++)
+      fprintf(epidemic->bound_outputs[k], "%d %d %d %d\n", t, u, v, epidemic->id);
+  } else if (epidemic->output) // print output: t P C F
+    fprintf(epidemic->output, "%d %d %d %d\n", t, u, v, epidemic->id);
+}
+
 /**
-   Run epidemic spreading until the bound condition (on time or size) is met
+   Whether the event from provider u to client v goes to the trace
+*/
+static inline int epidemic_traces(Epidemic *epidemic, int u, int v) {
+  return epidemic->tracing && (!epidemic->filter || trace_filter_nodes(epidemic->filter, u, v));
+}
+
+typedef enum _TraceMode {TraceOff, TraceAll, TraceNodes} TraceMode;
+
+/**
+   Counts provider u of time t, which made 'served' successful contacts
+   and infected 'offspring' nodes first, in the provider load and the
+   cascade statistics
+*/
+static inline void epidemic_count_provider(Epidemic *epidemic, int t, int u, int served, int offspring) {
+  if (provider_load && served)
+    load_add(t, u, served);
+  if (epidemic->stats)
+    stats_provider(epidemic->stats, t, served, offspring);
+}
+
+/**
+   Spreads the current frontier level, infected at time t, provider by
+   provider. Returns 1 if the bound on the number of infected nodes has
+   been met (the last one of a bound list). size_bound, trace and count
+   (whether providers are counted, see epidemic_count_provider) are
+   constants in each of the kernels below, which are thus compiled
+   without the tests they turn off.
  */
-void epidemic_run(Epidemic *epidemic) {
-  int i, u, v, t;
-  
-  while (!queue_empty(epidemic->active)) {
-    u = queue_get(epidemic->active); // provider
-    t = epidemic->infected[u];       // current time
-    if (epidemic->stop_criterion == MaxTime && epidemic->bound < t)
-      return;
-    for (i = 0; i < epidemic->g->degrees[u]; i++) {
-      v = epidemic->g->links[u][i];  // client
-      if ( (double)rand() <= (double)RAND_MAX * epidemic->p ) {
-	if ( !epidemic->infected[v] ) {
-	  epidemic->infected[v] = t+1;
-	  queue_add(epidemic->active, v);
-	  epidemic->num_infected++;
-	  epidemic->cascade_links++;
-	  epidemic->t = t;
-	  if (epidemic->stop_criterion == NumInfected && epidemic->bound == epidemic->num_infected) {
-	    if (epidemic->output) // print output: t P C F
-	      fprintf(epidemic->output, "%d %d %d %d\n", t, u, v, epidemic->id);
-	    return;
+static inline __attribute__((always_inline))
+int epidemic_spread_level(Epidemic *epidemic, int t, const int size_bound, const TraceMode trace,
+			  const int count) {
+  Frontier *active = epidemic->active;
+  graph *g = epidemic->g;
+  int *infected = epidemic->infected;
+  uint64_t seed = epidemic->seed, threshold = epidemic->threshold;
+  ArcVariates variates = epidemic->variates;
+  int i, k, u, v, served, offspring;
+
+  for (k = 0; k < active->size; k++) {
+    u = active->current[k];
+    served = offspring = 0;
+    for (i = 0; i < g->degrees[u]; i++) {
+      if (!arc_coin(seed, u, i, threshold, &variates))
+	continue;
+      v = g->links[u][i];  // client
+      served++;
+      if ( !infected[v] ) {
+	infected[v] = t+1;
+	frontier_add(active, v);
+	epidemic->num_infected++;
+	epidemic->cascade_links++;
+	epidemic->t = t;
+	offspring++;
+	if (size_bound && epidemic->next_infected == epidemic->num_infected) {
+	  if (trace == TraceAll || (trace == TraceNodes && trace_filter_nodes(epidemic->filter, u, v)))
+	    epidemic_record(epidemic, t, u, v);
+	  if (epidemic_bound_met(epidemic)) {
+	    if (count)
+	      epidemic_count_provider(epidemic, t, u, served, offspring);
+	    return 1;
 	  }
-	} else if (epidemic->infected[v] == t+1)
-	  epidemic->cascade_links++;
-	if (epidemic->output) // print output: t P C F
-	  fprintf(epidemic->output, "%d %d %d %d\n", t, u, v, epidemic->id);
+	  continue;
+	}
+      } else if (infected[v] == t+1)
+	epidemic->cascade_links++;
+      if (trace == TraceAll || (trace == TraceNodes && trace_filter_nodes(epidemic->filter, u, v)))
+	epidemic_record(epidemic, t, u, v);
+    }
+    if (count)
+      epidemic_count_provider(epidemic, t, u, served, offspring);
+  }
+  return 0;
+}
+
+#define EPIDEMIC_KERNEL(size_bound, trace, count)				\
+  static int epidemic_kernel_##size_bound##_##trace##_##count(Epidemic *epidemic, int t) { \
+    return epidemic_spread_level(epidemic, t, size_bound, trace, count);	\
+  }
+EPIDEMIC_KERNEL(0, TraceOff, 0)
+EPIDEMIC_KERNEL(0, TraceAll, 0)
+EPIDEMIC_KERNEL(0, TraceNodes, 0)
+EPIDEMIC_KERNEL(1, TraceOff, 0)
+EPIDEMIC_KERNEL(1, TraceAll, 0)
+EPIDEMIC_KERNEL(1, TraceNodes, 0)
+EPIDEMIC_KERNEL(0, TraceOff, 1)
+EPIDEMIC_KERNEL(0, TraceAll, 1)
+EPIDEMIC_KERNEL(0, TraceNodes, 1)
+EPIDEMIC_KERNEL(1, TraceOff, 1)
+EPIDEMIC_KERNEL(1, TraceAll, 1)
+EPIDEMIC_KERNEL(1, TraceNodes, 1)
+
+// kernels by provider counting (off, on), size bound (none, some) and trace mode
+static int (*const epidemic_kernels[2][2][3])(Epidemic *, int) = {
+  {{epidemic_kernel_0_TraceOff_0, epidemic_kernel_0_TraceAll_0, epidemic_kernel_0_TraceNodes_0},
+   {epidemic_kernel_1_TraceOff_0, epidemic_kernel_1_TraceAll_0, epidemic_kernel_1_TraceNodes_0}},
+  {{epidemic_kernel_0_TraceOff_1, epidemic_kernel_0_TraceAll_1, epidemic_kernel_0_TraceNodes_1},
+   {epidemic_kernel_1_TraceOff_1, epidemic_kernel_1_TraceAll_1, epidemic_kernel_1_TraceNodes_1}}
+};
+
+/**
+   Spreads the current frontier level, infected at time t, with the thread
+   team: chunks of the level run as tasks that claim new nodes by
+   compare-and-swap and append them to the next level by blocks, and their
+   trace events are flushed one buffer at a time.
+ */
+void epidemic_spread_team(Epidemic *epidemic, int t) {
+  int c, size = epidemic->active->size, chunks = (size + TEAM_CHUNK - 1) / TEAM_CHUNK;
+  int new_infected = 0, new_links = 0;
+
+  #pragma omp taskloop grainsize(1) default(shared) reduction(+:new_infected,new_links)
+  for (c = 0; c < chunks; c++) {
+    FrontierBlock block;
+    Event events[EVENT_BUFFER];
+    int e, i, k, u, v, expected, served, offspring, num_events = 0;
+    int end = (c+1)*TEAM_CHUNK < size ? (c+1)*TEAM_CHUNK : size;
+
+    block.size = 0;
+    for (k = c*TEAM_CHUNK; k < end; k++) {
+      u = epidemic->active->current[k];
+      served = offspring = 0;
+      for (i = 0; i < epidemic->g->degrees[u]; i++) {
+	if (!arc_coin(epidemic->seed, u, i, epidemic->threshold, &epidemic->variates))
+	  continue;
+	v = epidemic->g->links[u][i];
+	served++;
+	expected = 0;
+	if (__atomic_compare_exchange_n(epidemic->infected+v, &expected, t+1, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	  frontier_add_block(epidemic->active, &block, v);
+	  new_infected++;
+	  new_links++;
+	  offspring++;
+	} else if (expected == t+1)
+	  new_links++;
+	if (epidemic_traces(epidemic, u, v)) {
+	  if (num_events == EVENT_BUFFER) {
+	    #pragma omp critical (epidemic_trace)
+	    for (e = 0; e < num_events; e++)
+	      epidemic_record(epidemic, events[e].t, events[e].provider, events[e].client);
+	    num_events = 0;
+	  }
+	  events[num_events].t = t;
+	  events[num_events].provider = u;
+	  events[num_events++].client = v;
+	}
       }
+      if (provider_load || epidemic->stats)
+	epidemic_count_provider(epidemic, t, u, served, offspring);
+    }
+    frontier_flush(epidemic->active, &block);
+    if (num_events) {
+      #pragma omp critical (epidemic_trace)
+      for (e = 0; e < num_events; e++)
+	epidemic_record(epidemic, events[e].t, events[e].provider, events[e].client);
+    }
+  }
+  epidemic->num_infected  += new_infected;
+  epidemic->cascade_links += new_links;
+  if (new_infected)
+    epidemic->t = t;
+}
+
+/**
+   Number of arcs of the current frontier level
+ */
+static long epidemic_level_arcs(Epidemic *epidemic) {
+  long arcs = 0;
+  int k;
+  for (k = 0; k < epidemic->active->size; k++)
+    arcs += epidemic->g->degrees[epidemic->active->current[k]];
+  return arcs;
+}
+
+/**
+   Spreads the current frontier level and makes the next one current.
+   Returns 0 once the epidemic is over: no more active nodes, or the bound
+   condition (on time or size) is met.
+   Levels of at least team_threshold nodes are spread by the thread team;
+   under a size bound, only those levels that cannot reach it, so that the
+   cut-off matches the serial spreading.
+ */
+int epidemic_step(Epidemic *epidemic) {
+  Frontier *active = epidemic->active;
+  int t, team = 0, bound_met = 0, num_infected = epidemic->num_infected;
+  int cascade_links = epidemic->cascade_links;
+  int size_bound = epidemic->max_infected != INT_MAX;
+  long arcs = -1;
+  TraceMode trace;
+
+  if (frontier_empty(active))
+    return 0;
+  t = epidemic->infected[active->current[0]]; // current time
+  if (epidemic->max_time < t)
+    return 0;
+  if (epidemic->bounds && epidemic->max_infected == INT_MAX)
+    // time bounds of the list before t are met
+    while (epidemic->bounds[epidemic->next_bound] < t)
+      epidemic_bound_met(epidemic);
+  epidemic->tracing = epidemic->output && (!epidemic->filter || trace_filter_time(epidemic->filter, t));
+  if (epidemic->stats)
+    stats_step(epidemic->stats, t);
+#if PARALLEL
+  if (team_threshold > 0 && active->size >= team_threshold && omp_get_num_threads() > 1) {
+    if (size_bound)
+      arcs = epidemic_level_arcs(epidemic);
+    team = !size_bound || epidemic->num_infected + arcs < epidemic->next_infected;
+  }
+#endif
+  if (team)
+    epidemic_spread_team(epidemic, t);
+  else {
+    trace = !epidemic->tracing ? TraceOff : (epidemic->filter && epidemic->filter->nodes ? TraceNodes : TraceAll);
+    bound_met = epidemic_kernels[provider_load || epidemic->stats][size_bound][trace](epidemic, t);
+  }
+  if (epidemic->stats)
+    stats_infections(epidemic->stats, t, epidemic->num_infected - num_infected,
+		     epidemic->cascade_links - cascade_links);
+  if (metrics)
+    metrics_step(arcs >= 0 ? arcs : epidemic_level_arcs(epidemic),
+		 epidemic->num_infected - num_infected, active->next_size);
+  if (bound_met)
+    return 0;
+  memcpy(epidemic->touched + epidemic->num_touched, active->next, active->next_size * sizeof(int));
+  epidemic->num_touched += active->next_size;
+  frontier_swap(active);
+  return !frontier_empty(active);
+}
+
+/**
+   Writes the infected set of the epidemic: at the current time step if it
+   is chosen for snapshots, or its final set
+ */
+static void epidemic_snapshot(Epidemic *epidemic, int final) {
+  Frontier *active = epidemic->active;
+  int t;
+  if (final) {
+    // nodes of a level cut by the size bound are not in touched yet
+    memcpy(epidemic->touched + epidemic->num_touched, active->next, active->next_size * sizeof(int));
+    snapshot_write(epidemic->snapshots, epidemic->id, epidemic->sample_number, SNAPSHOT_END,
+		   epidemic->touched, epidemic->num_touched + active->next_size);
+  } else if (!frontier_empty(active)) {
+    t = epidemic->infected[active->current[0]];
+    if (snapshot_time(epidemic->snapshots, t))
+      snapshot_write(epidemic->snapshots, epidemic->id, epidemic->sample_number, t,
+		     epidemic->touched, epidemic->num_touched);
+  }
+}
+
+/**
+   Run epidemic spreading until the bound condition (on time or size) is met,
+   or until the deadline or a signal, checked between time steps
+ */
+void epidemic_run(Epidemic *epidemic) {
+  metrics_epidemic(0);
+  for (;;) {
+    if (epidemic->snapshots)
+      epidemic_snapshot(epidemic, 0);
+    if (!epidemic_step(epidemic))
+      break;
+    if (interrupted || (epidemic->deadline && omp_get_wtime() >= epidemic->deadline)) {
+      epidemic->truncated = interrupted ? Interrupted : Budget;
+      break;
     }
   }
+  // bounds of the list not met are those past the end of the epidemic
+  while (epidemic->bounds && epidemic->next_bound < epidemic->num_bounds)
+    epidemic_bound_met(epidemic);
+  if (epidemic->snapshots)
+    epidemic_snapshot(epidemic, 1);
+  if (epidemic->stats)
+    stats_sample(epidemic->stats, epidemic->cascade_links ? epidemic->t : 0);
+  metrics_epidemic(1);
 }
 
+// Epidemic drivers
+#include "split.c"
+#include "threshold.c"
+#include "analytic.c"
+#include "partition.c"
+#include "series.c"
+#include "variance.c"
+
 /**
    Allocates a set of n infected nodes' id
 */
-inline void ic_init(InitialCondition *ic, int n) {
+static inline void ic_init(InitialCondition *ic, int n) {
   ic->num_infected = n;
   ic->infected = (int *) calloc(n, sizeof(int));
   assert(ic->infected != NULL);
@@ -149,18 +573,37 @@ inline void ic_init(InitialCondition *ic, int n) {
 /**
    De-allocates a set of n infected nodes' id
 */
-inline void ic_clean(InitialCondition *ic) {
+static inline void ic_clean(InitialCondition *ic) {
   if(ic) {
     free(ic->infected);
     ic->infected = NULL;
     ic->num_infected = 0;
+    free(ic->bounds);
+    ic->bounds = NULL;
+    ic->num_bounds = 0;
   }
 }
 
+/**
+   Number of distinct infected nodes of ic, among n nodes
+*/
+static int ic_num_distinct(InitialCondition *ic, int n) {
+  char *seen = (char *) calloc(n > 0 ? n : 1, sizeof(char));
+  int i, distinct = 0;
+  assert(seen != NULL);
+  for (i = 0; i < ic->num_infected; i++)
+    if (!seen[ic->infected[i]]) {
+      seen[ic->infected[i]] = 1;
+      distinct++;
+    }
+  free(seen);
+  return distinct;
+}
+
 /**
    Returns the address of a new initial condition with one infected node (id = 0)
 */
-inline InitialCondition *ic_trivial() {
+static inline InitialCondition *ic_trivial() {
   InitialCondition *ic = (InitialCondition *) calloc(1,sizeof(InitialCondition));
   assert(ic != NULL);
   ic_init(ic, 1);
@@ -202,11 +645,12 @@ void ic_infect_randomly(InitialCondition *ic, int total_nodes) {
    otherwise read the nodes' id from the corresponding line
    File format:
    <number of epidemics>
-   <epidemic id> <N, number of infected nodes> [<node 1> ... <node N>]
+   <epidemic id> <N, number of infected nodes> [<node 1> ... <node N>] [<p>]
    ...
+   where p, if given, is the spreading probability of the epidemic.
 */
 int ic_import(InitialCondition **ic, FILE *input, int total_nodes) {
-  int i, j, id, num_infected, tokens_read, epidemics = 0;
+  int i, j, c, id, num_infected, tokens_read, epidemics = 0;
   assert(input != NULL);
   tokens_read = fscanf(input, "%d\n", &epidemics);
   assert(tokens_read == 1);
@@ -227,58 +671,238 @@ int ic_import(InitialCondition **ic, FILE *input, int total_nodes) {
 	tokens_read = fscanf(input, "%d", &(*ic+i)->infected[j]);
 	assert(tokens_read == 1);
       }
+    // optional spreading probability, ending the line
+    do
+      c = getc(input);
+    while (c == ' ' || c == '\t' || c == '\r');
+    if (c != '\n' && c != EOF) {
+      ungetc(c, input);
+      tokens_read = fscanf(input, "%lf", &(*ic+i)->p);
+      assert(tokens_read == 1 && (*ic+i)->p > 0.0 && (*ic+i)->p <= 1.0);
+    }
   }
   return epidemics;
 }
 
+typedef struct _PGroupKey {
+  double p;               // spreading probability
+  int j;                  // epidemic number
+} PGroupKey;
+
+static int pgroup_compare(const void *a, const void *b) {
+  const PGroupKey *x = (const PGroupKey *) a, *y = (const PGroupKey *) b;
+  if (x->p != y->p)
+    return x->p < y->p ? -1 : 1;
+  return x->j - y->j;
+}
+
+/**
+   Gives the global spreading probability p to the epidemics without their
+   own, and returns the order in which to run the epidemics: grouped by p,
+   in file order within a group, so that the epidemics run one after the
+   other share their p. *groups is set to the number of distinct p.
+*/
+int *ic_group_by_p(InitialCondition *ic, int epidemics, double p, int *groups) {
+  PGroupKey *keys = (PGroupKey *) malloc(epidemics * sizeof(PGroupKey));
+  int j, *order = (int *) malloc(epidemics * sizeof(int));
+  assert(keys != NULL && order != NULL);
+  for (j = 0; j < epidemics; j++) {
+    if (ic[j].p == 0.0)
+      ic[j].p = p;
+    keys[j].p = ic[j].p;
+    keys[j].j = j;
+  }
+  qsort(keys, epidemics, sizeof(PGroupKey), pgroup_compare);
+  *groups = 0;
+  for (j = 0; j < epidemics; j++) {
+    order[j] = keys[j].j;
+    *groups += j == 0 || keys[j].p != keys[j-1].p;
+  }
+  free(keys);
+  return order;
+}
+
+static int bound_compare(const void *a, const void *b) {
+  return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
 /**
    Import stop bounds for each epidemic in the array *ic from file
-   composed of a collection of lines with: <id> <bound>
+   composed of a collection of lines with: <id> <bound> [<bound> ...]
+   Several bounds make a bound list, evaluated from a single run of each
+   sample epidemic up to the largest bound. Returns the number of
+   epidemics with a bound list.
 */
-void ic_import_bounds(InitialCondition *ic, int n, Stopc stop_criterion, FILE *input) {
-  int i, id, bound, tokens_read;
+int ic_import_bounds(InitialCondition *ic, int n, Stopc stop_criterion, FILE *input) {
+  int i, k, c, id, bound, tokens_read, size, lists = 0;
   assert(n > 0);
   assert(ic != NULL);
   assert(input != NULL);
   
   for (i = 0; i < n; i++) {
-    tokens_read = fscanf(input, "%d %d\n", &id, &bound);
+    tokens_read = fscanf(input, "%d %d", &id, &bound);
     assert(tokens_read == 2);
     assert(id == ic[i].id);
     ic[i].bound = bound;
     ic[i].stop_criterion = stop_criterion;
+    // further bounds, ending the line
+    size = 0;
+    for (;;) {
+      do
+	c = getc(input);
+      while (c == ' ' || c == '\t' || c == '\r');
+      if (c == '\n' || c == EOF)
+	break;
+      ungetc(c, input);
+      if (ic[i].num_bounds == size) {
+	size = size ? 2 * size : 4;
+	ic[i].bounds = (int *) realloc(ic[i].bounds, size * sizeof(int));
+	assert(ic[i].bounds != NULL);
+	if (ic[i].num_bounds == 0)
+	  ic[i].bounds[ic[i].num_bounds++] = bound;
+      }
+      tokens_read = fscanf(input, "%d", ic[i].bounds + ic[i].num_bounds++);
+      assert(tokens_read == 1);
+    }
+    if (ic[i].num_bounds == 0)
+      continue;
+    qsort(ic[i].bounds, ic[i].num_bounds, sizeof(int), bound_compare);
+    for (k = 1, size = 1; k < ic[i].num_bounds; k++)
+      if (ic[i].bounds[k] != ic[i].bounds[size-1])
+	ic[i].bounds[size++] = ic[i].bounds[k];
+    ic[i].num_bounds = size;
+    ic[i].bound = ic[i].bounds[size-1];
+    if (size == 1) {
+      free(ic[i].bounds);
+      ic[i].bounds = NULL;
+      ic[i].num_bounds = 0;
+    } else
+      lists++;
   }
+  return lists;
+}
+
+/**
+   Trace output of the given bound, among the outputs of the n bound values
+   in increasing order
+*/
+static FILE *bound_output(int *values, FILE **outputs, int n, int bound) {
+  int *value = (int *) bsearch(&bound, values, n, sizeof(int), bound_compare);
+  assert(value != NULL);
+  return outputs[value - values];
 }
 
 /**
    Main
 */
 int main(int argc, char **argv) {
-  int i, j, epidemics, tid = 0;
-  char epidemic_output_path[MAX_PATH_LENGTH] = "";
+  int i, j, k, epidemics, groups, old_0 = 0, *perm, *order;
+  uint64_t seed = (uint64_t)time(NULL);
+  double start;
+  char *graph_text;
+  size_t graph_size;
+  long blocks;
+  PrepReport report = {0, 0, 0};
+  char epidemic_output_path[MAX_PATH_LENGTH] = "", index_path[MAX_PATH_LENGTH];
   FILE *graph_input, *ic_list_input, *bounds_list_input, 	\
     *data_output = NULL, *epidemic_output = NULL;
   graph *g;
   InitialCondition *ic;
-  Epidemic *epidemic;
+  TraceIndex *index = NULL;
   Stopc stop_criterion;
 
   // default parameters
   double p               = 0;    // neighbor infection probability
   int maxtime            = 0;    // global maximum epidemic simulation time
-  int sample_epidemics   = 1;    // number of sample epidemics
+  double max_fraction    = 0;    // if set, global bound on the fraction of infected nodes
+  int sample_epidemics   = 0;    // number of sample epidemics (default 1)
   int threads            = 1;    // number of threads
   char *graph_path       = NULL; // input path for graph (network) file
   char *ic_list_path     = NULL; // input path for list of epidemic initial parameters
   char *bounds_list_path = NULL; // input path for list of epidemic bounds
+  int bound_lists        = 0;    // number of epidemics with a bound list
+  int num_bound_values   = 0;    // with bound lists, distinct bounds of all epidemics ...
+  int *bound_values      = NULL;
+  FILE **bound_outputs   = NULL; // ... and their trace outputs
   char *trace_output_path= NULL; // output path for trace
+  int clean_graph        = 0;    // sort links, remove self-loops and duplicates
+  int symmetrize_graph   = 0;    // add missing reverse arcs
+  int relabel_graph      = 0;    // rename the nodes randomly
+  int directed_graph     = 0;    // links are arcs u -> v
+  int reverse_graph      = 0;    // spread along the reversed arcs
+  char *load_path        = NULL; // if set, write the provider load per time step there
+  int load_top           = LOAD_TOP; // number of top providers reported
+  char *stats_path       = NULL; // if set, write the cascade statistics of each epidemic there
+  FILE *stats_output     = NULL;
+  int analytic           = 0;    // estimate the epidemics by message passing instead
+  VarianceScheme variance = VarianceNone; // variance reduction of the sample epidemics
+  double variance_reduction = 0; // sum of the variance reductions achieved
+  int variance_estimates = 0;    // number of epidemics they were estimated for
+  char *tmp_dir          = NULL; // if set, group the trace by epidemic, spilling there
+  long buffer_mb         = 256;  // memory budget of each grouped trace buffer
+  int index_trace        = 0;    // write a sidecar index of the trace
+  char *split_levels     = NULL; // if set, estimate rare outbreaks by splitting at these sizes
+  Splitting splitting    = {0, NULL, 4};
+  char *giant_size       = NULL; // if set, find the threshold p of outbreaks of this size
+  ThresholdSearch search = {0, 0.001, THRESHOLD_MAX_SAMPLES, 0};
+  char *trace_nodes_path = NULL; // if set, trace only events involving these nodes
+  TraceFilter filter;            // events kept in the trace
+  int filtered           = 0;    // whether some filter is set
+  long sample_size       = 0;    // if set, events sampled per epidemic (or in all)
+  int sample_global      = 0;    // one sample of the events of all epidemics
+  int sample_stratified  = 0;    // one sample per time step
+  long sampled_seen = 0, sampled_written = 0;
+  TraceSample *global_sample = NULL;
+  double epidemic_budget = 0;    // if set, seconds allowed to each sample epidemic
+  double run_deadline    = 0;    // if set, wall-clock time to stop all epidemics at
+  int truncated = 0, not_run = 0;
+  struct sigaction action;
+  char *metrics_path     = NULL; // if set, export live metrics to this textfile or socket
+  double metrics_interval = METRICS_INTERVAL;
+  int partitions         = 1;    // worker processes sharing each epidemic
+  char *snapshot_path    = NULL; // if set, write infected sets to this file ...
+  char *snapshot_times   = NULL; // ... at these time steps and at the end
+  SnapshotOutput *snapshots = NULL;
+  char *series_path      = NULL; // if set, run on the graphs of the deltas listed there
+  GraphSeries *series;
+  char delta_path[MAX_PATH_LENGTH];
+  FILE *delta_input;
+  struct option long_options[] = {
+    {"find-threshold",      optional_argument, NULL, 'T'},
+    {"threshold-tolerance", required_argument, NULL, 'E'},
+    {"trace-time",          required_argument, NULL, 'W'},
+    {"trace-nodes",         required_argument, NULL, 'N'},
+    {"trace-nodes-as",      required_argument, NULL, 'A'},
+    {"trace-epidemics",     required_argument, NULL, 'F'},
+    {"trace-sample",        required_argument, NULL, 'S'},
+    {"trace-sample-global", no_argument,       NULL, 'G'},
+    {"trace-sample-steps",  no_argument,       NULL, 'U'},
+    {"epidemic-budget",     required_argument, NULL, 'B'},
+    {"run-budget",          required_argument, NULL, 'R'},
+    {"metrics",             required_argument, NULL, 'M'},
+    {"metrics-interval",    required_argument, NULL, 'I'},
+    {"partitions",          required_argument, NULL, 'P'},
+    {"snapshots",           required_argument, NULL, 'Q'},
+    {"snapshot-times",      required_argument, NULL, 'J'},
+    {"series",              required_argument, NULL, 'V'},
+    {"max-fraction",        required_argument, NULL, 'C'},
+    {"directed",            no_argument,       NULL, 'D'},
+    {"reverse",             no_argument,       NULL, 'Y'},
+    {"load",                required_argument, NULL, 'O'},
+    {"load-top",            required_argument, NULL, 'H'},
+    {"cascade-stats",       required_argument, NULL, 'X'},
+    {"analytic",            no_argument,       NULL, 'Z'},
+    {"variance-reduction",  required_argument, NULL, 'v'},
+    {NULL, 0, NULL, 0}
+  };
 
   // parameter parsing
   char syntax[] = "\n Required parameters:\n\t -p SPREADING_PROBABILITY\n\t -g GRAPH_PATH\n \
 Required parameters (one choice among the options):\n\t -t GLOBAL_MAX_TIME\n\t -a MAX_TIME_LIST_PATH\n\t -b MAX_INFECTED_LIST_PATH\n \
-Optional parameters:\n\t -s NUM_SAMPLE_EPIDEMICS\n\t -i INITIAL_CONDITIONS_DATA_PATH \n\t -h NUM_THREADS\n \t -e [STATUS_OUTPUT_PATH]\n\t -o SPREADING_OUTPUT\n\n";
+Optional parameters:\n\t -s NUM_SAMPLE_EPIDEMICS\n\t -i INITIAL_CONDITIONS_DATA_PATH \n\t -h NUM_THREADS\n \t -e [STATUS_OUTPUT_PATH]\n\t -o SPREADING_OUTPUT\n\t -f TEAM_FRONTIER_THRESHOLD\n\t -c (clean graph)\n\t -y (symmetrize graph)\n\t -z (relabel nodes randomly)\n\t -r RANDOM_SEED\n\t -d TMP_DIR (group trace by epidemic)\n\t -m TRACE_BUFFER_MB\n\t -x (index trace)\n\t -L SPLIT_LEVELS (e.g. 0.01,0.05,0.1)\n\t -K SPLIT_FACTOR\n\t --find-threshold[=GIANT_SIZE]\n\t --threshold-tolerance=TOLERANCE\n\t --trace-time=[FIRST_TIME]:[LAST_TIME]\n\t --trace-nodes=NODE_LIST_PATH\n\t --trace-nodes-as=P|C|PC\n\t --trace-epidemics=EPIDEMIC_IDS (e.g. 0,3,10-20)\n\t --trace-sample=NUM_EVENTS\n\t --trace-sample-global\n\t --trace-sample-steps\n\t --epidemic-budget=SECONDS\n\t --run-budget=SECONDS\n\t --metrics=TEXTFILE_PATH|unix:SOCKET_PATH\n\t --metrics-interval=SECONDS\n\t --partitions=NUM_PROCESSES\n\t --snapshots=SNAPSHOT_PATH\n\t --snapshot-times=TIMES (e.g. 1,5,10-20)\n\t --series=DELTA_LIST_PATH\n\t --max-fraction=FRACTION\n\t --directed\n\t --reverse\n\t --load=LOAD_PATH\n\t --load-top=NUM_PROVIDERS\n\t --cascade-stats=STATS_PATH\n\t --analytic\n\t --variance-reduction=antithetic|rqmc|control\n\n";
   fprintf(stderr, "SIMPLE EPIDEMIC CASCADE SIMULATION:\n\n");
-  while ((i = getopt(argc, argv, "e::o:p:s:g:i:t:a:b:h:")) != -1)
+  trace_filter_init(&filter);
+  while ((i = getopt_long(argc, argv, "e::o:p:s:g:i:t:a:b:h:f:cyzr:d:m:xL:K:", long_options, NULL)) != -1)
     switch (i) {
     case 'p':
       p = atof(optarg);
@@ -302,38 +926,192 @@ Optional parameters:\n\t -s NUM_SAMPLE_EPIDEMICS\n\t -i INITIAL_CONDITIONS_DATA_
       ic_list_path = optarg;
       break;
     case 't':
-      assert(bounds_list_path == NULL);
       maxtime = atoi(optarg);
-      stop_criterion = MaxTime;
       break;
     case 'a':
     case 'b':
-      assert(maxtime <= 0);
+      assert(bounds_list_path == NULL);
       bounds_list_path = optarg;
       stop_criterion = i - 'a';
       break;
     case 'h':
       threads = atoi(optarg);
       break;
+    case 'f':
+      team_threshold = atoi(optarg);
+      break;
+    case 'c':
+      clean_graph = 1;
+      break;
+    case 'y':
+      clean_graph = symmetrize_graph = 1;
+      break;
+    case 'z':
+      relabel_graph = 1;
+      break;
+    case 'r':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'd':
+      tmp_dir = optarg;
+      break;
+    case 'm':
+      buffer_mb = atol(optarg);
+      break;
+    case 'x':
+      index_trace = 1;
+      break;
+    case 'L':
+      split_levels = optarg;
+      break;
+    case 'K':
+      splitting.factor = atoi(optarg);
+      break;
+    case 'T':
+      giant_size = optarg ? optarg : "0.1";
+      break;
+    case 'E':
+      search.tolerance = atof(optarg);
+      break;
+    case 'W':
+      time_range_parse(optarg, &filter.tmin, &filter.tmax);
+      filtered = 1;
+      break;
+    case 'N':
+      trace_nodes_path = optarg;
+      filtered = 1;
+      break;
+    case 'A':
+      assert(strspn(optarg, "PC") == strlen(optarg) && strlen(optarg) > 0);
+      filter.provider = strchr(optarg, 'P') != NULL;
+      filter.client = strchr(optarg, 'C') != NULL;
+      break;
+    case 'F':
+      filter.num_ids = ranges_parse(optarg, &filter.ids);
+      filtered = 1;
+      break;
+    case 'S':
+      sample_size = atol(optarg);
+      break;
+    case 'G':
+      sample_global = 1;
+      break;
+    case 'U':
+      sample_stratified = 1;
+      break;
+    case 'B':
+      epidemic_budget = atof(optarg);
+      break;
+    case 'R':
+      run_deadline = atof(optarg);
+      break;
+    case 'M':
+      metrics_path = optarg;
+      break;
+    case 'I':
+      metrics_interval = atof(optarg);
+      break;
+    case 'P':
+      partitions = atoi(optarg);
+      break;
+    case 'Q':
+      snapshot_path = optarg;
+      break;
+    case 'J':
+      snapshot_times = optarg;
+      break;
+    case 'V':
+      series_path = optarg;
+      break;
+    case 'C':
+      max_fraction = atof(optarg);
+      break;
+    case 'D':
+      directed_graph = 1;
+      break;
+    case 'Y':
+      reverse_graph = 1;
+      break;
+    case 'O':
+      load_path = optarg;
+      break;
+    case 'H':
+      load_top = atoi(optarg);
+      break;
+    case 'X':
+      stats_path = optarg;
+      break;
+    case 'Z':
+      analytic = 1;
+      break;
+    case 'v':
+      for (variance = VarianceAntithetic; variance <= VarianceControl; variance++)
+	if (strcmp(optarg, variance_description[variance]) == 0)
+	  break;
+      if (variance > VarianceControl)
+	report_error("main: unknown variance reduction scheme");
+      break;
     case '?':
       fputs(syntax, stderr);
     default:
       abort();
     }
-  assert(p > 0.0 && p <= 1.0);
-  assert(sample_epidemics > 0);
+  assert(giant_size || (p > 0.0 && p <= 1.0));
+  assert(sample_epidemics >= 0);
   assert(graph_path || ic_list_path);
-  assert(bounds_list_path || maxtime > 0);
+  assert(bounds_list_path || maxtime > 0 || max_fraction > 0);
+  assert(max_fraction >= 0 && max_fraction <= 1);
+  // a time bound (-t) and a size bound (-b or --max-fraction) combine
+  if (!bounds_list_path)
+    stop_criterion = max_fraction > 0 ? (maxtime > 0 ? MaxTimeSize : FracInfected) : MaxTime;
+  else if (stop_criterion == NumInfected)
+    stop_criterion = maxtime > 0 ? MaxTimeSize : NumInfected;
+  assert(stop_criterion == MaxTime ? !max_fraction : !(bounds_list_path && max_fraction));
+  assert(!bounds_list_path || stop_criterion != MaxTime || maxtime <= 0);
   assert(threads > 0);
+  assert(team_threshold >= 0);
+  assert(buffer_mb > 0);
+  assert(splitting.factor > 0);
+  assert(!split_levels || (!trace_output_path && stop_criterion == MaxTime));
+  assert(epidemic_budget >= 0 && run_deadline >= 0);
+  assert(metrics_interval > 0);
+  assert(sample_size >= 0 && (sample_size || (!sample_global && !sample_stratified)));
+  assert(!giant_size || (!trace_output_path && !split_levels && search.tolerance > 0));
+  if (giant_size && sample_epidemics)
+    search.max_samples = sample_epidemics;
+  if (sample_epidemics == 0)
+    sample_epidemics = 1;
+  assert(!variance || (sample_epidemics > 1 && partitions == 1 && !split_levels && !giant_size && !series_path
+		       && !analytic));
+  assert(partitions > 0 && (partitions == 1 || (sample_epidemics == 1 && !tmp_dir && !sample_size
+						&& !split_levels && !giant_size && !snapshot_path)));
+  assert(!series_path || (!relabel_graph && partitions == 1 && !tmp_dir && !sample_size && !index_trace
+			  && !snapshot_path && !split_levels && !giant_size && !directed_graph));
+  assert(!reverse_graph || (directed_graph && !symmetrize_graph));
+  assert(load_top >= 0 && (!load_path || (!series_path && partitions == 1 && !split_levels && !giant_size)));
+  assert(!stats_path || (!series_path && partitions == 1 && !split_levels && !giant_size));
+  assert(!analytic || (!series_path && partitions == 1 && !split_levels && !giant_size && !load_path
+		       && !stats_path && !snapshot_path && (!directed_graph || symmetrize_graph)
+		       && stop_criterion == MaxTime));
 
   // preliminaires
-  srand((unsigned)time(NULL));
+  srand((unsigned)seed);
+  if (run_deadline)
+    run_deadline += omp_get_wtime();
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  action.sa_flags = SA_RESTART | SA_RESETHAND; // blocking writes go on, a second signal is fatal
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
   #if PARALLEL
     omp_set_num_threads(threads);
   #else
     threads = 1;
   #endif
-  fprintf(stderr,"Number of threads: %d %s %s\n\n", threads,
+  if (metrics_path)
+    metrics = metrics_start(metrics_path, metrics_interval, omp_get_max_threads());
+  fprintf(stderr,"Number of threads: %d, random seed: %llu %s %s\n\n", threads, (unsigned long long)seed,
 	  !trace_output_path? "" : ", with trace output", !trace_output_path? "" : trace_output_path);
   fflush(stderr);
 
@@ -345,7 +1123,7 @@ Optional parameters:\n\t -s NUM_SAMPLE_EPIDEMICS\n\t -i INITIAL_CONDITIONS_DATA_
     epidemics = 1;
     ic = ic_trivial();
   } else {
-    ic_list_input = fopen(ic_list_path, "r");
+    ic_list_input = input_open(ic_list_path);
     epidemics = ic_import(&ic, ic_list_input, 0);
     fclose(ic_list_input);
   }
@@ -354,61 +1132,351 @@ Optional parameters:\n\t -s NUM_SAMPLE_EPIDEMICS\n\t -i INITIAL_CONDITIONS_DATA_
   fprintf(stderr,"Setting bounds (%s) for epidemics...\n", 
 	  bounds_list_path? bounds_list_path : ":global:");
   fflush(stderr);
-  if(maxtime)
-    for(i = 0; i < epidemics; i++) {
-      ic[i].bound = maxtime;
-      ic[i].stop_criterion = MaxTime;
-    }
-  else {
-    bounds_list_input = fopen(bounds_list_path, "r");
-    ic_import_bounds(ic, epidemics, stop_criterion, bounds_list_input);
+  for(i = 0; i < epidemics; i++) {
+    ic[i].bound = maxtime; // size bounds are set below
+    ic[i].max_time = maxtime;
+    ic[i].stop_criterion = stop_criterion;
+  }
+  if (bounds_list_path) {
+    bounds_list_input = input_open(bounds_list_path);
+    bound_lists = ic_import_bounds(ic, epidemics, stop_criterion, bounds_list_input);
     fclose(bounds_list_input);
   }
-  fprintf(stderr,"  Loaded %d epidemics.\n\n", epidemics);
+  assert(!bound_lists || (partitions == 1 && !tmp_dir && !index_trace && !sample_size && !split_levels
+			  && !giant_size && !series_path && !analytic));
+  order = ic_group_by_p(ic, epidemics, p, &groups);
+  if (groups > 1)
+    fprintf(stderr,"  Loaded %d epidemics in %d groups of spreading probability.\n\n", epidemics, groups);
+  else
+    fprintf(stderr,"  Loaded %d epidemics.\n\n", epidemics);
   fflush(stderr);
 
   // load underlying graph
   fprintf(stderr,"%s\nLoading the graph %s...\n", tstamp(), graph_path? graph_path : "");
   fflush(stderr);
-  if (!graph_path)
-    graph_input = stdin;
-  else 
-    graph_input = fopen(graph_path, "r");
-  assert(graph_input != NULL);
-  g = graph_from_file(graph_input);
-  if (graph_input != stdin)
-    fclose(graph_input);
-  fprintf(stderr,"  Loaded graph with %d nodes, %d links.\n\n", g->n, g->m);
+  start = omp_get_wtime();
+  graph_text = input_load(graph_path, &graph_size, &blocks); // stdin if no path
+  g = graph_from_text(graph_text, graph_size, directed_graph);
+  free(graph_text);
+  fprintf(stderr,"  Loaded %sgraph with %d nodes, %d %s in %.2fs", g->directed ? "directed " : "",
+	  g->n, g->m, g->directed ? "arcs" : "links", omp_get_wtime() - start);
+  if (blocks > 0)
+    fprintf(stderr," (decompressed %ld blocks in parallel)", blocks);
+  else if (blocks == 0)
+    fprintf(stderr," (decompressed)");
+  fprintf(stderr,".\n\n");
   fflush(stderr);
+  if (max_fraction > 0)
+    for (i = 0; i < epidemics; i++)
+      ic[i].bound = (int) ceil(max_fraction * g->n);
+  if (trace_nodes_path) {
+    graph_input = input_open(trace_nodes_path);
+    if (graph_input == NULL)
+      report_error("main: cannot open the trace node list");
+    trace_filter_load_nodes(&filter, graph_input, g->n);
+    fclose(graph_input);
+  }
 
-  // set global epidemic_output
-  assert(sample_epidemics == 1);
-  if (trace_output_path && strlen(trace_output_path) > 0) {
+  // preprocess underlying graph
+  if (clean_graph) {
+    fprintf(stderr,"%s\nPreprocessing the graph%s...\n", tstamp(), symmetrize_graph? " (symmetrized)" : "");
+    fflush(stderr);
+    start = omp_get_wtime();
+    graph_clean(g, &report);
+    if (symmetrize_graph)
+      graph_symmetrize(g, &report);
+    fprintf(stderr,"  Removed %ld self-loop arcs and %ld duplicate arcs, added %ld reverse arcs in %.2fs;\n"
+	    "  graph with %d nodes, %d %s.\n\n", report.self_loops, report.duplicates,
+	    report.reversed, omp_get_wtime() - start, g->n, g->m, g->directed ? "arcs" : "links");
+    fflush(stderr);
+  }
+
+  // rename nodes randomly, including those of the initial conditions
+  if (relabel_graph) {
+    fprintf(stderr,"%s\nRelabeling the nodes randomly...\n", tstamp());
+    fflush(stderr);
+    start = omp_get_wtime();
+    perm = graph_random_relabel(g, rng_hash(seed, 0x72656c6162656cULL), &old_0);
+    for (j = 0; j < epidemics; j++)
+      for (k = 0; k < ic[j].num_infected; k++) {
+	assert(ic[j].infected[k] >= 0 && ic[j].infected[k] < g->n);
+	ic[j].infected[k] = perm[ic[j].infected[k]];
+      }
+    trace_filter_relabel(&filter, perm, g->n);
+    free(perm);
+    fprintf(stderr,"  Relabeled %d nodes in %.2fs.\n\n", g->n, omp_get_wtime() - start);
+    fflush(stderr);
+  }
+
+  // reverse CSR: only the reversed arcs are kept
+  if (reverse_graph) {
+    graph *r;
+    fprintf(stderr,"%s\nReversing the arcs...\n", tstamp());
+    fflush(stderr);
+    start = omp_get_wtime();
+    r = graph_transpose(g);
+    free_graph_old_start(g, old_0);
+    g = r;
+    old_0 = 0;
+    fprintf(stderr,"  Reversed %d arcs in %.2fs.\n\n", g->m, omp_get_wtime() - start);
+    fflush(stderr);
+  }
+
+  // estimate rare outbreaks: samples are the root epidemics
+  if (split_levels) {
+    splitting_parse(&splitting, split_levels, g->n);
+    fprintf(stderr,"%s\nSplitting %d root epidemics in %d branches at sizes %s...\n\n",
+	    tstamp(), sample_epidemics, splitting.factor, split_levels);
+    fflush(stderr);
+    splitting_estimate(g, ic, epidemics, sample_epidemics, &splitting, seed,
+		       data_output ? data_output : stdout);
+    free(splitting.levels);
+    for (j = 0; j < epidemics; j++)
+      ic_clean(ic+j);
+    sample_epidemics = 0;
+    epidemics = 0;
+  }
+
+  // find the epidemic thresholds: samples are per candidate p
+  if (giant_size) {
+    search.giant = atof(giant_size) < 1 ? (int)(atof(giant_size) * g->n + 0.999999) : atoi(giant_size);
+    assert(search.giant > 0);
+    fprintf(stderr,"%s\nFinding the thresholds of outbreaks of %d nodes, up to %d samples per candidate...\n\n",
+	    tstamp(), search.giant, search.max_samples);
+    fflush(stderr);
+    threshold_find(g, ic, epidemics, &search, seed, data_output ? data_output : stdout);
+    for (j = 0; j < epidemics; j++)
+      ic_clean(ic+j);
+    sample_epidemics = 0;
+    epidemics = 0;
+  }
+
+  // estimate the epidemics by message passing: no samples
+  if (analytic) {
+    FILE *probabilities = NULL;
+    if (trace_output_path && strlen(trace_output_path) > 0) {
+      sprintf(epidemic_output_path,"%s-%s.probs",trace_output_path,stopc_description[stop_criterion]);
+      probabilities = fopen(epidemic_output_path, "w");
+      if (probabilities == NULL)
+	report_error("main: cannot open the infection probabilities output");
+    }
+    fprintf(stderr,"%s\nPassing messages for %d epidemics...\n\n", tstamp(), epidemics);
+    fflush(stderr);
+    analytic_estimate(g, ic, epidemics, data_output ? data_output : stdout, probabilities);
+    if (probabilities)
+      fclose(probabilities);
+    for (j = 0; j < epidemics; j++)
+      ic_clean(ic+j);
+    sample_epidemics = 0;
+    epidemics = 0;
+    trace_output_path = NULL;
+  }
+
+  // run the epidemics on each graph of a series: the base graph, then the
+  // graph of each delta applied to the previous one
+  if (series_path) {
+    fprintf(stderr,"%s\nLoading the graph series %s...\n", tstamp(), series_path);
+    fflush(stderr);
+    start = omp_get_wtime();
+    series = series_new(g);
+    graph_input = input_open(series_path);
+    if (graph_input == NULL)
+      report_error("main: cannot open the list of deltas");
+    while (fscanf(graph_input, "%4095s", delta_path) == 1) {
+      delta_input = input_open(delta_path);
+      if (delta_input == NULL)
+	report_error("main: cannot open a delta");
+      k = series_add(series, delta_input);
+      fclose(delta_input);
+      fprintf(stderr,"  Graph %d: %d arcs changed by %s, %d links.\n",
+	      series->num_graphs - 1, k, delta_path, series->links[series->num_graphs - 1]);
+    }
+    fclose(graph_input);
+    fprintf(stderr,"  Loaded %d graphs in %.2fs, with %.1f MB besides the base graph.\n\n",
+	    series->num_graphs, omp_get_wtime() - start, series->bytes / 1048576.0);
+    fflush(stderr);
+    assert(sample_epidemics <= 1 || !trace_output_path || strlen(trace_output_path) == 0);
+    if (metrics)
+      metrics_expect(metrics, NULL, (long)series->num_graphs * epidemics * sample_epidemics);
+    series_run(series, ic, epidemics, sample_epidemics, seed, filtered ? &filter : NULL,
+	       trace_output_path && strlen(trace_output_path) > 0 ? trace_output_path : NULL,
+	       stopc_description[stop_criterion], data_output, epidemic_budget, run_deadline,
+	       &truncated, &not_run);
+    series_destroy(series);
+    for (j = 0; j < epidemics; j++)
+      ic_clean(ic+j);
+    sample_epidemics = 0;
+    epidemics = 0;
+    trace_output_path = NULL;
+  }
+
+  // set global epidemic_output; several sample epidemics only without a trace
+  assert(sample_epidemics <= 1 || !trace_output_path || strlen(trace_output_path) == 0);
+  if (bound_lists && trace_output_path && strlen(trace_output_path) > 0) {
+    // one trace per bound value, for the epidemics of all bound lists
+    for (j = 0; j < epidemics; j++)
+      num_bound_values += ic[j].num_bounds ? ic[j].num_bounds : 1;
+    bound_values = (int *) malloc(num_bound_values * sizeof(int));
+    assert(bound_values != NULL);
+    for (j = 0, i = 0; j < epidemics; j++)
+      if (ic[j].num_bounds)
+	for (k = 0; k < ic[j].num_bounds; k++)
+	  bound_values[i++] = ic[j].bounds[k];
+      else
+	bound_values[i++] = ic[j].bound;
+    qsort(bound_values, num_bound_values, sizeof(int), bound_compare);
+    for (k = 1, i = 1; k < num_bound_values; k++)
+      if (bound_values[k] != bound_values[i-1])
+	bound_values[i++] = bound_values[k];
+    num_bound_values = i;
+    bound_outputs = (FILE **) malloc(num_bound_values * sizeof(FILE *));
+    assert(bound_outputs != NULL);
+    for (k = 0; k < num_bound_values; k++) {
+      sprintf(epidemic_output_path,"%s-%s-%d.trace",trace_output_path,stopc_description[stop_criterion],
+	      bound_values[k]);
+      bound_outputs[k] = fopen(epidemic_output_path, "w");
+      assert(bound_outputs[k] != NULL);
+    }
+    epidemic_output = NULL;
+  } else if (trace_output_path && strlen(trace_output_path) > 0) {
     sprintf(epidemic_output_path,"%s-%s.trace",trace_output_path,stopc_description[stop_criterion]);
     epidemic_output = fopen(epidemic_output_path, "w");
     assert(epidemic_output != NULL);
+    if (index_trace) {
+      sprintf(index_path,"%s.idx",epidemic_output_path);
+      index = trace_index_new(index_path);
+    }
+    if (sample_size && sample_global)
+      global_sample = trace_sample_new(sample_size, sample_stratified, rng_hash(seed, 0x73616d706c65ULL));
   } else
     epidemic_output = NULL;
 
+  if (snapshot_path)
+    snapshots = snapshot_output_new(snapshot_path, snapshot_times, g->n);
+  if (load_path)
+    provider_load = load_new(omp_get_max_threads(), load_top);
+  if (stats_path) {
+    stats_output = fopen(stats_path, "w");
+    if (stats_output == NULL)
+      report_error("main: cannot open the cascade statistics output");
+    fprintf(stats_output, "# depth epidemic_id depth samples\n"
+	    "# step epidemic_id t providers infections contacts links R repeat_ratio offspring_0 1 2 ...\n");
+  }
+  if (metrics)
+    metrics_expect(metrics, epidemic_output, (long)epidemics * sample_epidemics);
+
+  // one epidemic at a time, partitioned among worker processes
+  if (partitions > 1) {
+    Epidemic epidemic;
+    for (k = 0; k < epidemics; k++) {
+      j = order[k];
+      fprintf(stderr,"%s- running epidemic %d with p = %f upto %s = %d with %d processes ...\n",
+	      tstamp(), ic[j].id, ic[j].p, stopc_description[stop_criterion], ic[j].bound, partitions);
+      fflush(stderr);
+      memset(&epidemic, 0, sizeof(Epidemic));
+      epidemic.id            = ic[j].id;
+      epidemic.t             = 1;
+      epidemic.num_infected  = ic_num_distinct(ic+j, g->n);
+      epidemic.p             = ic[j].p;
+      epidemic.threshold     = arc_threshold(ic[j].p);
+      epidemic.seed          = rng_hash(seed, ((uint64_t)j << 32) | 1);
+      epidemic.g             = g;
+      epidemic.output        = epidemic_output && trace_filter_epidemic(&filter, ic[j].id) ? epidemic_output : NULL;
+      epidemic.index         = index;
+      epidemic.filter        = filtered ? &filter : NULL;
+      if (data_output) {
+	fprintf(data_output, "Epidemic %d #1: started at t = %d with %d / %d ( %.2f%% ) infected nodes\n",
+		epidemic.id, epidemic.t, epidemic.num_infected, g->n, 100.0*(float)epidemic.num_infected/(float)g->n);
+	fflush(data_output);
+      }
+      partition_run(&epidemic, ic+j, partitions, getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+      if (data_output) {
+	fprintf(data_output,
+		"Epidemic %d #1: stopped at t = %d with %d / %d ( %.2f%% ) infected nodes and %d links\n",
+		epidemic.id, epidemic.t, epidemic.num_infected, g->n,
+		100.0*(float)epidemic.num_infected/(float)g->n, epidemic.cascade_links);
+	fflush(data_output);
+      }
+      ic_clean(ic+j);
+    }
+    epidemics = 0;
+  }
+
+  // one task per epidemic; large frontier levels of any epidemic spawn
+  // further tasks (see epidemic_run), which idle threads pick up
   #if PARALLEL
   #pragma omp parallel default(none)					\
-  private(tid,epidemic,i,j)						\
-  shared(stderr,stopc_description,p,g,ic,epidemics,sample_epidemics,data_output,\
-	 stop_criterion,trace_output_path,  epidemic_output,epidemic_output_path)
+  private(k)								\
+  shared(stderr,stdout,stopc_description,g,ic,order,epidemics,sample_epidemics,data_output,\
+	 stop_criterion,trace_output_path,epidemic_output,epidemic_output_path,seed,\
+	 tmp_dir,buffer_mb,index,filter,filtered,sample_size,sample_stratified,\
+	 global_sample,sampled_seen,sampled_written,epidemic_budget,run_deadline,\
+	 truncation_description,truncated,not_run,interrupted,snapshots,stats_output,\
+	 variance,variance_description,variance_reduction,variance_estimates,\
+	 bound_values,bound_outputs,num_bound_values)
+  #pragma omp single
   #endif
-  {
+  for (k = 0; k < epidemics; k++) {
   #if PARALLEL
-    tid = omp_get_thread_num();
-    #pragma omp for schedule(guided)
+  #pragma omp task default(shared) firstprivate(k)
+  #endif
+    {
+      int i, b, tid = 0, j = order[k];
+      Epidemic *epidemic = NULL;
+      TraceBuffer *buffer = NULL;
+      TraceSample *sample = NULL;
+      CascadeStats *stats = stats_output ? stats_new() : NULL;
+      SizeEstimate *estimate = variance ? estimate_new(sample_epidemics,
+						       variates_group(variance_variates(variance), sample_epidemics),
+						       variance == VarianceControl) : NULL;
+      ArcVariates variates;
+      uint64_t sample_seed;
+      FILE *output = epidemic_output && trace_filter_epidemic(&filter, ic[j].id) ? epidemic_output : NULL;
+      FILE **outputs = NULL; // with a bound list, trace output of each bound
+      if (bound_outputs && trace_filter_epidemic(&filter, ic[j].id)) {
+	if (ic[j].num_bounds) {
+	  outputs = (FILE **) malloc(ic[j].num_bounds * sizeof(FILE *));
+	  assert(outputs != NULL);
+	  for (i = 0; i < ic[j].num_bounds; i++)
+	    outputs[i] = bound_output(bound_values, bound_outputs, num_bound_values, ic[j].bounds[i]);
+	}
+	output = bound_output(bound_values, bound_outputs, num_bound_values, ic[j].bound);
+      }
+  #if PARALLEL
+      tid = omp_get_thread_num();
   #endif
-    for (j = 0; j < epidemics; j++) {
       fprintf(stderr,"%s- thread %d: running epidemic %d with p = %f upto %s = %d %s%s ...\n",
-	      tstamp(), tid, ic[j].id, p, stopc_description[stop_criterion], ic[j].bound,
+	      tstamp(), tid, ic[j].id, ic[j].p, stopc_description[stop_criterion], ic[j].bound,
 	      !trace_output_path? "" : ", output: ", !trace_output_path? "" : trace_output_path);
       fflush(stderr);
+      if (sample_size && output)
+	sample = trace_sample_new(sample_size, sample_stratified, 0);
+      else if (tmp_dir && output)
+	buffer = trace_buffer_new(buffer_mb * (1L << 20) / sizeof(Event), tmp_dir);
       
       for (i = 1; i <= sample_epidemics; i++) {
-	epidemic = epidemic_new(p, g, ic+j, epidemic_output);
+	if (interrupted || (run_deadline && omp_get_wtime() >= run_deadline)) {
+	  #pragma omp atomic
+	  not_run += sample_epidemics - i + 1;
+	  break;
+	}
+	sample_seed = arc_sample(seed, j, i, variance_variates(variance), estimate ? estimate->group : 1, &variates);
+	if (i == 1) {
+	  epidemic = epidemic_new(ic[j].p, g, ic+j, output, sample_seed);
+	  epidemic->buffer = buffer;
+	  epidemic->index = index;
+	  epidemic->filter = filtered ? &filter : NULL;
+	  epidemic->sample = sample;
+	  epidemic->snapshots = snapshots;
+	  epidemic->stats = stats;
+	  epidemic->bound_outputs = outputs;
+	} else // reuse the workspace of the previous sample
+	  epidemic_restart(epidemic, ic+j, sample_seed);
+	epidemic->variates = variates;
+	epidemic->sample_number = i;
+	epidemic->deadline = epidemic_budget ? omp_get_wtime() + epidemic_budget : 0;
+	if (run_deadline && (!epidemic->deadline || run_deadline < epidemic->deadline))
+	  epidemic->deadline = run_deadline;
 	
 	if (data_output) {
 	  fprintf(data_output,
@@ -418,28 +1486,119 @@ Optional parameters:\n\t -s NUM_SAMPLE_EPIDEMICS\n\t -i INITIAL_CONDITIONS_DATA_
 	  fflush(data_output);
 	}
 
+	if (sample)
+	  trace_sample_reset(sample, rng_hash(seed ^ 0x73616d706c65ULL, ((uint64_t)j << 32) | (uint32_t)i));
 	epidemic_run(epidemic);
+	if (epidemic->truncated) {
+	  #pragma omp atomic
+	  truncated++;
+	}
+	if (estimate)
+	  estimate_add(estimate, epidemic->num_infected, !estimate->control ? 0 :
+		       estimate_first_contacts(epidemic, ic+j, &estimate->control_mean));
 
-	if (epidemic_output)
-	  fflush(epidemic_output);
+	if (buffer) {
+	  #pragma omp critical (epidemic_output)
+	  trace_buffer_commit(buffer, epidemic_output, index, epidemic->id);
+	}
+	if (sample) {
+	  #pragma omp critical (epidemic_output)
+	  {
+	    if (global_sample)
+	      trace_sample_merge(global_sample, sample);
+	    else
+	      sampled_written += trace_sample_write(sample, epidemic_output, index, &sampled_seen);
+	  }
+	  trace_sample_reset(sample, 0);
+	}
+	if (output)
+	  fflush(output);
 
 	if (data_output) {
 	  fprintf(data_output, 
-		  "Epidemic %d #%d: stopped at t = %d with %d / %d ( %.2f%% ) infected nodes and %d links\n",
+		  "Epidemic %d #%d: stopped at t = %d with %d / %d ( %.2f%% ) infected nodes and %d links%s\n",
 		  epidemic->id,i, epidemic->t, epidemic->num_infected,
 		  epidemic->g->n, 100.0*(float)epidemic->num_infected/(float)epidemic->g->n,
-		  epidemic->cascade_links);
+		  epidemic->cascade_links, truncation_description[epidemic->truncated]);
+	  for (b = 0; epidemic->bounds && b < epidemic->num_bounds; b++)
+	    fprintf(data_output,
+		    "Epidemic %d #%d: at %s = %d, stopped at t = %d with %d / %d ( %.2f%% ) infected nodes and %d links\n",
+		    epidemic->id, i, stopc_description[stop_criterion], epidemic->bounds[b],
+		    epidemic->bound_results[b].t, epidemic->bound_results[b].num_infected, epidemic->g->n,
+		    100.0*(float)epidemic->bound_results[b].num_infected/(float)epidemic->g->n,
+		    epidemic->bound_results[b].cascade_links);
 	  fflush(data_output);
 	}
-
+      }
+      free(outputs);
+      if (epidemic)
 	epidemic_destroy(epidemic);
+      if (buffer)
+	trace_buffer_destroy(buffer);
+      if (sample)
+	trace_sample_destroy(sample);
+      if (stats) {
+	#pragma omp critical (epidemic_stats)
+	stats_write(stats, ic[j].id, stats_output);
+	stats_destroy(stats);
+      }
+      if (estimate) {
+	if (estimate->samples > 0) {
+	  #pragma omp critical (epidemic_estimate)
+	  {
+	    double reduction = estimate_write(estimate, ic[j].id, variance_description[variance],
+					      data_output ? data_output : stdout);
+	    if (reduction > 0) {
+	      variance_reduction += reduction;
+	      variance_estimates++;
+	    }
+	  }
+	}
+	estimate_destroy(estimate);
       }
       ic_clean(ic+j);
     }
   }
-  // close global epidemic_output
+  // write the sample of all epidemics and close global epidemic_output
+  if (global_sample) {
+    sampled_written = trace_sample_write(global_sample, epidemic_output, index, &sampled_seen);
+    trace_sample_destroy(global_sample);
+  }
+  if (sample_size && epidemic_output)
+    fprintf(stderr,"  Sampled %ld of %ld trace events.\n", sampled_written, sampled_seen);
+  if (snapshots) {
+    fprintf(stderr,"  Wrote %ld snapshots of infected sets (%ld bytes).\n", snapshots->records, snapshots->bytes);
+    snapshot_output_close(snapshots);
+  }
+  if (variance_estimates)
+    fprintf(stderr,"  Variance reduction (%s): %.2fx on average over %d epidemics.\n",
+	    variance_description[variance], variance_reduction / variance_estimates, variance_estimates);
+  if (stats_output) {
+    fprintf(stderr,"  Wrote the cascade statistics to %s.\n", stats_path);
+    fclose(stats_output);
+  }
+  if (provider_load) {
+    FILE *load_output = fopen(load_path, "w");
+    if (load_output == NULL)
+      report_error("main: cannot open the load output");
+    fprintf(stderr,"  Wrote the load of %ld (time step, provider) pairs to %s.\n",
+	    load_write(provider_load, g->n, load_output), load_path);
+    fclose(load_output);
+    load_destroy(provider_load);
+  }
+  if (truncated || not_run)
+    fprintf(stderr,"  %d sample epidemics truncated and %d not run%s.\n", truncated, not_run,
+	    interrupted ? " (interrupted)" : " (time budget)");
+  if (metrics)
+    metrics_stop(metrics);
+  if (index)
+    trace_index_close(index);
   if (epidemic_output)
     fclose(epidemic_output);
+  for (k = 0; k < num_bound_values; k++)
+    fclose(bound_outputs[k]);
+  free(bound_outputs);
+  free(bound_values);
 
   // clean up and exit
   if (data_output && data_output != stdout)
@@ -448,7 +1607,9 @@ Optional parameters:\n\t -s NUM_SAMPLE_EPIDEMICS\n\t -i INITIAL_CONDITIONS_DATA_
   fputc('\n', stderr);
   fprintf(stderr,"%s\nDone.\n", tstamp());
   fflush(stderr);
-  free_graph(g);
+  trace_filter_clean(&filter);
+  free_graph_old_start(g, old_0);
   free(ic);
-  return 0;
+  free(order);
+  return interrupted ? 128 + interrupted : 0;
 }
@@ -0,0 +1,307 @@
+/*
+  Graph series: a base graph followed by graphs that each differ from the
+  previous one by a delta, a list of added and removed links, e.g. daily
+  snapshots of an overlay. Each graph of the series is a table of chunks
+  of SERIES_CHUNK nodes (their degrees and adjacency list pointers): a
+  graph shares the chunks of the previous one, or those of the base graph,
+  except the chunks with a changed node, which are copied; only the lists
+  of changed nodes are new. The series thus takes little more memory than
+  the base graph, and any graph of it is laid out in a single graph
+  structure (pointers only) to be simulated.
+*/
+
+#define SERIES_CHUNK 4096 // nodes per chunk
+
+typedef struct _SeriesChunk {
+  int *degrees;           // degrees of the nodes of the chunk
+  int **links;            // their adjacency lists
+} SeriesChunk;
+
+typedef struct _SeriesChange {
+  int u, v;               // arc u -> v ...
+  int add;                // ... added (1) or removed (0)
+  int line;               // line of the delta, for errors
+} SeriesChange;
+
+typedef struct _GraphSeries {
+  graph *base;            // first graph
+  int num_graphs;         // number of graphs, including the base one
+  int num_chunks;         // chunks per graph
+  SeriesChunk ***chunks;  // chunk table of each graph
+  int *links;             // number of links of each graph
+  int num_blocks;         // memory allocated for the series ...
+  void **blocks;          // ... freed with it
+  long bytes;             // its size
+} GraphSeries;
+
+static void *series_alloc(GraphSeries *s, size_t bytes) {
+  void *block = malloc(bytes > 0 ? bytes : 1);
+  assert(block != NULL);
+  if ((s->num_blocks & (s->num_blocks - 1)) == 0) { // doubled at powers of 2
+    s->blocks = (void **) realloc(s->blocks, (s->num_blocks > 0 ? 2 * s->num_blocks : 1) * sizeof(void *));
+    assert(s->blocks != NULL);
+  }
+  s->blocks[s->num_blocks++] = block;
+  s->bytes += bytes;
+  return block;
+}
+
+GraphSeries *series_new(graph *base) {
+  GraphSeries *s = (GraphSeries *) calloc(1, sizeof(GraphSeries));
+  SeriesChunk *chunk = NULL;
+  int c;
+  assert(s != NULL);
+  s->base = base;
+  s->num_graphs = 1;
+  s->num_chunks = (base->n + SERIES_CHUNK - 1) / SERIES_CHUNK;
+  s->chunks = (SeriesChunk ***) malloc(sizeof(SeriesChunk **));
+  s->links = (int *) malloc(sizeof(int));
+  assert(s->chunks != NULL && s->links != NULL);
+  s->chunks[0] = (SeriesChunk **) series_alloc(s, s->num_chunks * sizeof(SeriesChunk *));
+  s->links[0] = base->m;
+  // the chunks of the base graph point into it
+  for (c = 0; c < s->num_chunks; c++) {
+    chunk = s->chunks[0][c] = (SeriesChunk *) series_alloc(s, sizeof(SeriesChunk));
+    chunk->degrees = base->degrees + (long)c * SERIES_CHUNK;
+    chunk->links = base->links + (long)c * SERIES_CHUNK;
+  }
+  return s;
+}
+
+void series_destroy(GraphSeries *s) {
+  int k;
+  for (k = 0; k < s->num_blocks; k++)
+    free(s->blocks[k]);
+  free(s->blocks);
+  free(s->chunks);
+  free(s->links);
+  free(s);
+}
+
+static int change_compare(const void *a, const void *b) {
+  const SeriesChange *x = (const SeriesChange *) a, *y = (const SeriesChange *) b;
+  if (x->u != y->u)
+    return x->u < y->u ? -1 : 1;
+  return (x->line > y->line) - (x->line < y->line);
+}
+
+/**
+   Reads a delta: lines '+ u v' (added link) or '- u v' (removed link)
+*/
+static long series_read_delta(FILE *input, int n, SeriesChange **changes) {
+  char line[MAX_LINE_LENGTH], op;
+  long num = 0, capacity = 1024;
+  int u, v, number = 0;
+  *changes = (SeriesChange *) malloc(capacity * sizeof(SeriesChange));
+  assert(*changes != NULL);
+  while (fgets(line, MAX_LINE_LENGTH, input) != NULL) {
+    number++;
+    if (sscanf(line, " %c %d %d", &op, &u, &v) != 3 || (op != '+' && op != '-')) {
+      if (sscanf(line, " %c", &op) != 1)
+	continue; // blank line
+      fprintf(stderr, "Line %d of the delta: %s", number, line);
+      report_error("series_read_delta: read error");
+    }
+    if (u < 0 || u >= n || v < 0 || v >= n) {
+      fprintf(stderr, "Line %d of the delta: %s", number, line);
+      report_error("series_read_delta: bad node number");
+    }
+    if (num + 2 > capacity) {
+      capacity *= 2;
+      *changes = (SeriesChange *) realloc(*changes, capacity * sizeof(SeriesChange));
+      assert(*changes != NULL);
+    }
+    (*changes)[num].u = u;
+    (*changes)[num].v = v;
+    (*changes)[num].add = op == '+';
+    (*changes)[num++].line = number;
+    (*changes)[num].u = v;
+    (*changes)[num].v = u;
+    (*changes)[num].add = op == '+';
+    (*changes)[num++].line = number;
+  }
+  return num;
+}
+
+/**
+   Appends to the series the graph obtained by applying a delta to its
+   last graph. Removed links lose one copy, later neighbors moving up;
+   added links go to the end of the lists. Returns the number of arcs
+   changed.
+*/
+long series_add(GraphSeries *s, FILE *delta) {
+  SeriesChange *changes;
+  SeriesChunk **previous = s->chunks[s->num_graphs - 1], **table, *chunk = NULL;
+  long num, a, b, k;
+  long arcs = 2L * s->links[s->num_graphs - 1];
+  int c, u, degree, removed, *list, last_chunk = -1;
+
+  num = series_read_delta(delta, s->base->n, &changes);
+  qsort(changes, num, sizeof(SeriesChange), change_compare);
+  s->chunks = (SeriesChunk ***) realloc(s->chunks, (s->num_graphs + 1) * sizeof(SeriesChunk **));
+  s->links = (int *) realloc(s->links, (s->num_graphs + 1) * sizeof(int));
+  assert(s->chunks != NULL && s->links != NULL);
+  table = s->chunks[s->num_graphs] = (SeriesChunk **) series_alloc(s, s->num_chunks * sizeof(SeriesChunk *));
+  memcpy(table, previous, s->num_chunks * sizeof(SeriesChunk *));
+
+  for (a = 0; a < num; a = b) {
+    u = changes[a].u;
+    for (b = a; b < num && changes[b].u == u; b++)
+      ;
+    // copy the chunk of u on its first change
+    c = u / SERIES_CHUNK;
+    if (c != last_chunk) {
+      chunk = table[c] = (SeriesChunk *) series_alloc(s, sizeof(SeriesChunk));
+      chunk->degrees = (int *) series_alloc(s, SERIES_CHUNK * sizeof(int));
+      chunk->links = (int **) series_alloc(s, SERIES_CHUNK * sizeof(int *));
+      k = (c+1) * SERIES_CHUNK <= s->base->n ? SERIES_CHUNK : s->base->n - c * SERIES_CHUNK;
+      memcpy(chunk->degrees, previous[c]->degrees, k * sizeof(int));
+      memcpy(chunk->links, previous[c]->links, k * sizeof(int *));
+      last_chunk = c;
+    }
+    // new list of u
+    degree = chunk->degrees[u % SERIES_CHUNK];
+    list = (int *) series_alloc(s, (degree + b - a) * sizeof(int));
+    memcpy(list, chunk->links[u % SERIES_CHUNK], degree * sizeof(int));
+    for (k = a; k < b; k++)
+      if (changes[k].add)
+	list[degree++] = changes[k].v;
+      else {
+	for (removed = 0; removed < degree && list[removed] != changes[k].v; removed++)
+	  ;
+	if (removed == degree) {
+	  fprintf(stderr, "Line %d of the delta: link %d %d\n", changes[k].line, changes[k].u, changes[k].v);
+	  report_error("series_add: removing a missing link");
+	}
+	memmove(list + removed, list + removed + 1, (degree - removed - 1) * sizeof(int));
+	degree--;
+      }
+    arcs += degree - chunk->degrees[u % SERIES_CHUNK];
+    chunk->degrees[u % SERIES_CHUNK] = degree;
+    chunk->links[u % SERIES_CHUNK] = list;
+  }
+  s->links[s->num_graphs++] = arcs / 2;
+  free(changes);
+  return num;
+}
+
+/**
+   Lays graph k of the series out in view, which must have room for the
+   degrees and lists of the base graph's nodes
+*/
+void series_view(GraphSeries *s, int k, graph *view) {
+  int c;
+  long size;
+  assert(k >= 0 && k < s->num_graphs);
+  view->n = s->base->n;
+  view->m = s->links[k];
+  #pragma omp parallel for private(size)
+  for (c = 0; c < s->num_chunks; c++) {
+    size = (c+1) * SERIES_CHUNK <= view->n ? SERIES_CHUNK : view->n - c * SERIES_CHUNK;
+    memcpy(view->degrees + (long)c * SERIES_CHUNK, s->chunks[k][c]->degrees, size * sizeof(int));
+    memcpy(view->links + (long)c * SERIES_CHUNK, s->chunks[k][c]->links, size * sizeof(int *));
+  }
+}
+
+/**
+   Runs the sample epidemics of each initial condition, at its spreading
+   probability, on each graph of the series. Sample i of an epidemic has
+   the same seed on every graph, but a coin is keyed by the position of
+   its arc in the list of the provider: only the nodes whose lists no
+   delta changed keep the same coins from graph to graph (a removal moves
+   the later neighbors up, see series_add). Epidemics run in parallel on
+   the thread workspaces; traces go to one file per graph, named after
+   trace_path (if set) and the graph number. filter, if set, selects the
+   traced events. A sample epidemic stops after epidemic_budget seconds
+   or at run_deadline (if set), and the samples left at run_deadline are
+   not run; both are counted in truncated and not_run.
+*/
+void series_run(GraphSeries *s, InitialCondition *ic, int epidemics, int sample_epidemics,
+		uint64_t seed, TraceFilter *filter, const char *trace_path, const char *stopc,
+		FILE *data_output, double epidemic_budget, double run_deadline,
+		int *truncated, int *not_run) {
+  int k, j, threads = omp_get_max_threads();
+  char path[MAX_PATH_LENGTH];
+  graph view;
+  FILE *output;
+  Epidemic **workspace = (Epidemic **) malloc(threads * sizeof(Epidemic *));
+  view.degrees = (int *) malloc((s->base->n > 0 ? s->base->n : 1) * sizeof(int));
+  view.links = (int **) malloc((s->base->n > 0 ? s->base->n : 1) * sizeof(int *));
+  view.capacities = NULL;
+  view.directed = s->base->directed;
+  assert(workspace != NULL && view.degrees != NULL && view.links != NULL);
+  series_view(s, 0, &view);
+  for (k = 0; k < threads; k++)
+    workspace[k] = epidemic_new(ic->p, &view, ic, NULL, seed);
+
+  for (k = 0; k < s->num_graphs; k++) {
+    if (interrupted || (run_deadline && omp_get_wtime() >= run_deadline)) {
+      *not_run += (s->num_graphs - k) * epidemics * sample_epidemics;
+      break;
+    }
+    series_view(s, k, &view);
+    output = NULL;
+    if (trace_path) {
+      snprintf(path, MAX_PATH_LENGTH, "%s-%d-%s.trace", trace_path, k, stopc);
+      output = fopen(path, "w");
+      if (output == NULL)
+	report_error("series_run: cannot open the trace output");
+    }
+    fprintf(stderr, "%s- running %d epidemics on graph %d of the series (%d links)%s%s ...\n",
+	    tstamp(), epidemics, k, view.m, output ? ", output: " : "", output ? path : "");
+    fflush(stderr);
+    #pragma omp parallel for schedule(dynamic,1)
+    for (j = 0; j < epidemics; j++) {
+      Epidemic *epidemic = workspace[omp_get_thread_num()];
+      int i;
+      epidemic_set_p(epidemic, ic[j].p);
+      for (i = 1; i <= sample_epidemics; i++) {
+	if (interrupted || (run_deadline && omp_get_wtime() >= run_deadline)) {
+	  #pragma omp atomic
+	  *not_run += sample_epidemics - i + 1;
+	  break;
+	}
+	epidemic_restart(epidemic, ic+j, rng_hash(seed, ((uint64_t)j << 32) | (uint32_t)i));
+	epidemic->output = output && (!filter || trace_filter_epidemic(filter, ic[j].id)) ? output : NULL;
+	epidemic->filter = filter;
+	epidemic->deadline = epidemic_budget ? omp_get_wtime() + epidemic_budget : 0;
+	if (run_deadline && (!epidemic->deadline || run_deadline < epidemic->deadline))
+	  epidemic->deadline = run_deadline;
+	if (data_output) {
+	  #pragma omp critical (epidemic_output)
+	  {
+	    fprintf(data_output,
+		    "Graph %d, epidemic %d #%d: started at t = %d with %d / %d ( %.2f%% ) infected nodes\n",
+		    k, epidemic->id, i, epidemic->t, epidemic->num_infected, view.n,
+		    100.0*(float)epidemic->num_infected/(float)view.n);
+	    fflush(data_output);
+	  }
+	}
+	epidemic_run(epidemic);
+	if (epidemic->truncated) {
+	  #pragma omp atomic
+	  (*truncated)++;
+	}
+	if (data_output) {
+	  #pragma omp critical (epidemic_output)
+	  {
+	    fprintf(data_output,
+		    "Graph %d, epidemic %d #%d: stopped at t = %d with %d / %d ( %.2f%% ) infected nodes and %d links%s\n",
+		    k, epidemic->id, i, epidemic->t, epidemic->num_infected, view.n,
+		    100.0*(float)epidemic->num_infected/(float)view.n, epidemic->cascade_links,
+		    truncation_description[epidemic->truncated]);
+	    fflush(data_output);
+	  }
+	}
+      }
+    }
+    if (output)
+      fclose(output);
+  }
+
+  for (k = 0; k < threads; k++)
+    epidemic_destroy(workspace[k]);
+  free(workspace);
+  free(view.degrees);
+  free(view.links);
+}
@@ -0,0 +1,90 @@
+/*
+  Snapshots of infected sets: at chosen time steps of each sample epidemic,
+  and at its end, the set of infected nodes is appended to a binary file
+  as a compressed bitmap (see bitmap.c), built from the lists of infected
+  nodes of the epidemic rather than from its trace. The file starts with
+  SNAPSHOT_MAGIC and the number of nodes, followed by records: a
+  SnapshotRecord, then the serialized bitmap.
+*/
+
+#define SNAPSHOT_MAGIC "SCSNAP1\n"
+#define SNAPSHOT_END 0 // time of the final sets
+
+typedef struct _SnapshotRecord {
+  int32_t id;             // epidemic id
+  int32_t sample;         // sample epidemic, from 1
+  int32_t t;              // time step, or SNAPSHOT_END
+  uint32_t cardinality;   // number of infected nodes
+  int64_t bytes;          // size of the bitmap that follows
+} SnapshotRecord;
+
+typedef struct _SnapshotOutput {
+  FILE *output;           // snapshot file
+  int num_times;          // number of ranges of time steps ...
+  Range *times;           // ... snapshot before the end (none if 0)
+  long records;           // records written
+  long bytes;             // bytes written
+} SnapshotOutput;
+
+/**
+   Creates the snapshot file for a graph of n nodes; times is a list of time
+   steps such as 1,5,10-20, or NULL for the final sets only
+*/
+SnapshotOutput *snapshot_output_new(const char *path, char *times, int n) {
+  SnapshotOutput *s = (SnapshotOutput *) calloc(1, sizeof(SnapshotOutput));
+  int32_t nodes = n;
+  assert(s != NULL);
+  s->output = fopen(path, "wb");
+  if (s->output == NULL)
+    report_error("snapshot_output_new: cannot open the snapshot file");
+  if (times)
+    s->num_times = ranges_parse(times, &s->times);
+  fwrite(SNAPSHOT_MAGIC, 1, 8, s->output);
+  fwrite(&nodes, sizeof(int32_t), 1, s->output);
+  s->bytes = 8 + sizeof(int32_t);
+  return s;
+}
+
+/**
+   Whether time step t is snapshot before the end
+*/
+static inline int snapshot_time(SnapshotOutput *s, int t) {
+  return s->num_times > 0 && ranges_contain(s->times, s->num_times, t);
+}
+
+/**
+   Appends the set of the n nodes of the list as the snapshot of sample
+   epidemic (id, sample) at time t. The bitmap is built by the calling
+   thread; only the write is serialized.
+*/
+void snapshot_write(SnapshotOutput *s, int id, int sample, int t, const int *nodes, long n) {
+  Bitmap *b = bitmap_from_nodes(nodes, n);
+  SnapshotRecord r;
+  char *buffer;
+  r.id = id;
+  r.sample = sample;
+  r.t = t;
+  r.cardinality = bitmap_cardinality(b);
+  r.bytes = bitmap_bytes(b);
+  buffer = (char *) malloc(r.bytes);
+  assert(buffer != NULL);
+  bitmap_serialize(b, buffer);
+  bitmap_destroy(b);
+  #pragma omp critical (epidemic_snapshot)
+  {
+    if (fwrite(&r, sizeof(SnapshotRecord), 1, s->output) != 1
+	|| fwrite(buffer, 1, r.bytes, s->output) != (size_t)r.bytes)
+      report_error("snapshot_write: write error");
+    s->records++;
+    s->bytes += sizeof(SnapshotRecord) + r.bytes;
+  }
+  free(buffer);
+}
+
+void snapshot_output_close(SnapshotOutput *s) {
+  assert(s != NULL);
+  if (fclose(s->output) != 0)
+    report_error("snapshot_output_close: write error");
+  free(s->times);
+  free(s);
+}
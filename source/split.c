@@ -0,0 +1,207 @@
+/*
+  Rare large outbreaks by multilevel splitting: an epidemic that grows past
+  an intermediate size level is split into 'factor' branches, which go on
+  independently (with their own arc coins) and weigh 1/factor each. The
+  weights of the branches reaching the last level, averaged over the root
+  epidemics, estimate the probability of reaching it without bias.
+
+  A split only saves the infected nodes and their times, and the branches
+  of a split share that saved state until they are resumed.
+*/
+
+typedef struct _EpidemicState {
+  int t;                  // time steps elapsed
+  int num_infected;       // number of infected nodes
+  int cascade_links;      // number of arcs in the infection cascade
+  int num_touched;        // number of saved nodes
+  int frontier_size;      // active nodes: the last ones saved
+  int *nodes;             // infected nodes, by level
+  int *times;             // their time of infection
+  int branches;           // branches yet to resume from this state
+} EpidemicState;
+
+typedef struct _Branch {
+  EpidemicState *state;   // state at the split
+  uint64_t seed;          // seed of the arc coins of the branch
+  double weight;          // weight of the branch
+  int level;              // next level to reach
+} Branch;
+
+typedef struct _Splitting {
+  int num_levels;         // number of levels
+  int *levels;            // increasing sizes; the last one is the target
+  int factor;             // branches per split
+} Splitting;
+
+/**
+   Saves the infected nodes of an epidemic, between two levels
+*/
+EpidemicState *epidemic_save(Epidemic *epidemic) {
+  int k;
+  EpidemicState *state = (EpidemicState *) malloc(sizeof(EpidemicState));
+  assert(state != NULL);
+  assert(epidemic->active->next_size == 0);
+  state->t             = epidemic->t;
+  state->num_infected  = epidemic->num_infected;
+  state->cascade_links = epidemic->cascade_links;
+  state->num_touched   = epidemic->num_touched;
+  state->frontier_size = epidemic->active->size;
+  state->nodes = (int *) malloc((epidemic->num_touched + 1) * sizeof(int));
+  state->times = (int *) malloc((epidemic->num_touched + 1) * sizeof(int));
+  assert(state->nodes != NULL && state->times != NULL);
+  memcpy(state->nodes, epidemic->touched, epidemic->num_touched * sizeof(int));
+  for (k = 0; k < epidemic->num_touched; k++)
+    state->times[k] = epidemic->infected[epidemic->touched[k]];
+  state->branches = 0;
+  return state;
+}
+
+/**
+   Resumes an epidemic from a saved state, with new arc coins
+*/
+void epidemic_load(Epidemic *epidemic, EpidemicState *state, uint64_t seed) {
+  Frontier *active = epidemic->active;
+  int k;
+  for (k = 0; k < epidemic->num_touched; k++)
+    epidemic->infected[epidemic->touched[k]] = 0;
+  for (k = 0; k < active->next_size; k++)
+    epidemic->infected[active->next[k]] = 0;
+  memcpy(epidemic->touched, state->nodes, state->num_touched * sizeof(int));
+  for (k = 0; k < state->num_touched; k++)
+    epidemic->infected[state->nodes[k]] = state->times[k];
+  epidemic->num_touched = state->num_touched;
+  memcpy(active->current, state->nodes + state->num_touched - state->frontier_size,
+	 state->frontier_size * sizeof(int));
+  active->size = state->frontier_size;
+  active->next_size = 0;
+  epidemic->t             = state->t;
+  epidemic->num_infected  = state->num_infected;
+  epidemic->cascade_links = state->cascade_links;
+  epidemic->seed          = seed;
+}
+
+static void state_release(EpidemicState *state) {
+  if (--state->branches == 0) {
+    free(state->nodes);
+    free(state->times);
+    free(state);
+  }
+}
+
+/**
+   Parses a comma-separated list of increasing levels: fractions of the
+   n nodes if below 1, numbers of nodes otherwise
+*/
+void splitting_parse(Splitting *sp, char *list, int n) {
+  char *item, *save = NULL;
+  double x;
+  sp->num_levels = 0;
+  sp->levels = NULL;
+  for (item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    x = atof(item);
+    assert(x > 0);
+    sp->levels = (int *) realloc(sp->levels, (sp->num_levels+1) * sizeof(int));
+    assert(sp->levels != NULL);
+    sp->levels[sp->num_levels] = x < 1 ? (int)(x * n + 0.999999) : (int)x;
+    assert(sp->num_levels == 0 || sp->levels[sp->num_levels] > sp->levels[sp->num_levels-1]);
+    sp->num_levels++;
+  }
+  assert(sp->num_levels > 0);
+}
+
+/**
+   Runs a root epidemic from ic and all its branches. Returns the total
+   weight of the branches that reached the last level; *branches is
+   increased by the number of branches run.
+*/
+double split_run(Epidemic *epidemic, InitialCondition *ic, uint64_t seed, Splitting *sp, long *branches) {
+  Branch *stack = NULL, branch;
+  EpidemicState *state;
+  int b, level = 0, size = 0, capacity = 0;
+  double weight = 1, hits = 0;
+
+  epidemic_restart(epidemic, ic, seed);
+  for (;;) {
+    (*branches)++;
+    for (;;) {
+      if (epidemic->num_infected >= sp->levels[level]) {
+	if (level == sp->num_levels-1) {
+	  hits += weight;
+	  break;
+	}
+	if (sp->factor == 1) {
+	  level++;
+	  continue;
+	}
+	// split: this branch goes on as the first one
+	state = epidemic_save(epidemic);
+	state->branches = sp->factor-1;
+	if (size + sp->factor > capacity) {
+	  capacity = 2*capacity + sp->factor;
+	  stack = (Branch *) realloc(stack, capacity * sizeof(Branch));
+	  assert(stack != NULL);
+	}
+	weight /= sp->factor;
+	level++;
+	for (b = 1; b < sp->factor; b++) {
+	  stack[size].state  = state;
+	  stack[size].seed   = rng_hash(epidemic->seed, b);
+	  stack[size].weight = weight;
+	  stack[size++].level = level;
+	}
+	epidemic->seed = rng_hash(epidemic->seed, 0);
+	continue;
+      }
+      if (!epidemic_step(epidemic))
+	break;
+    }
+    if (size == 0)
+      break;
+    branch = stack[--size];
+    epidemic_load(epidemic, branch.state, branch.seed);
+    state_release(branch.state);
+    weight = branch.weight;
+    level = branch.level;
+  }
+  free(stack);
+  return hits;
+}
+
+/**
+   Estimates, for each initial condition, the probability that its epidemic
+   reaches the last splitting level, from 'roots' root epidemics each
+*/
+void splitting_estimate(graph *g, InitialCondition *ic, int epidemics, int roots,
+			Splitting *sp, uint64_t seed, FILE *output) {
+  double *z = (double *) malloc(roots * sizeof(double));
+  double mean, var, start;
+  long branches;
+  int i, j;
+  assert(z != NULL);
+
+  for (j = 0; j < epidemics; j++) {
+    start = omp_get_wtime();
+    branches = 0;
+    #pragma omp parallel reduction(+:branches)
+    {
+      Epidemic *epidemic = epidemic_new(ic[j].p, g, ic+j, NULL, seed);
+      #pragma omp for schedule(dynamic,1)
+      for (i = 0; i < roots; i++)
+	z[i] = split_run(epidemic, ic+j, rng_hash(seed, ((uint64_t)j << 32) | (uint32_t)(i+1)),
+			 sp, &branches);
+      epidemic_destroy(epidemic);
+    }
+    for (i = 0, mean = 0; i < roots; i++)
+      mean += z[i];
+    mean /= roots;
+    for (i = 0, var = 0; i < roots; i++)
+      var += (z[i] - mean) * (z[i] - mean);
+    var = roots > 1 ? var / (roots - 1) : 0;
+    fprintf(output, "Epidemic %d: P(size >= %d) = %.6g +- %.3g (95%% CI) from %d roots and %ld branches "
+	    "in %.2fs; variance per root %.3g, plain Monte Carlo %.3g\n",
+	    ic[j].id, sp->levels[sp->num_levels-1], mean, 1.96 * sqrt(var / roots), roots, branches,
+	    omp_get_wtime() - start, var, mean * (1 - mean));
+    fflush(output);
+  }
+  free(z);
+}
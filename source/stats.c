@@ -0,0 +1,114 @@
+/*
+  Cascade structure statistics: per time step of the sample epidemics of an
+  initial condition, the providers spread, the nodes they infected, their
+  successful contacts and the cascade links, from which the effective
+  reproduction number and the ratio of repeat links follow, with the
+  offspring distribution of the providers (number of nodes each one
+  infected first); and the distribution of the cascade depths. The
+  counters are summed over the samples, which run one after the other on
+  the same task; providers spread by a thread team are counted with
+  atomic adds.
+*/
+
+#define STATS_OFFSPRING 16 // offspring counts with their own bin, larger ones share the last
+
+typedef struct _StepStats {
+  long providers;         // providers spread
+  long infections;        // nodes they infected
+  long contacts;          // their successful contacts
+  long links;             // cascade links (arcs to the nodes infected at the step)
+  long offspring[STATS_OFFSPRING]; // providers by number of nodes infected first
+} StepStats;
+
+typedef struct _CascadeStats {
+  long samples;           // sample epidemics counted
+  int num_steps;          // time steps with counters
+  StepStats *steps;       // counters of time steps 1, 2, ...
+  long *depths;           // samples by depth (last time step with infections, 0 if none), up to num_steps
+} CascadeStats;
+
+CascadeStats *stats_new() {
+  CascadeStats *s = (CascadeStats *) calloc(1, sizeof(CascadeStats));
+  assert(s != NULL);
+  s->depths = (long *) calloc(1, sizeof(long)); // depth 0
+  assert(s->depths != NULL);
+  return s;
+}
+
+void stats_destroy(CascadeStats *s) {
+  free(s->steps);
+  free(s->depths);
+  free(s);
+}
+
+/**
+   Makes room for the counters of time step t; called before the step is
+   spread, so that the providers of a team step find them in place
+*/
+static inline void stats_step(CascadeStats *s, int t) {
+  int k = s->num_steps;
+  if (t <= k)
+    return;
+  s->num_steps = t > 2 * k ? t : 2 * k;
+  s->steps = (StepStats *) realloc(s->steps, s->num_steps * sizeof(StepStats));
+  s->depths = (long *) realloc(s->depths, (s->num_steps + 1) * sizeof(long));
+  assert(s->steps != NULL && s->depths != NULL);
+  memset(s->steps + k, 0, (s->num_steps - k) * sizeof(StepStats));
+  memset(s->depths + k + 1, 0, (s->num_steps - k) * sizeof(long));
+}
+
+/**
+   Counts a provider of time step t that made 'contacts' successful
+   contacts and infected 'offspring' nodes first
+*/
+static inline void stats_provider(CascadeStats *s, int t, int contacts, int offspring) {
+  StepStats *step = s->steps + t - 1;
+  __atomic_fetch_add(&step->providers, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&step->contacts, contacts, __ATOMIC_RELAXED);
+  __atomic_fetch_add(step->offspring + (offspring < STATS_OFFSPRING ? offspring : STATS_OFFSPRING - 1),
+		     1, __ATOMIC_RELAXED);
+}
+
+/**
+   Counts the infections and cascade links of time step t, once it is spread
+*/
+static inline void stats_infections(CascadeStats *s, int t, long infections, long links) {
+  s->steps[t-1].infections += infections;
+  s->steps[t-1].links += links;
+}
+
+/**
+   Counts a sample epidemic of the given depth
+*/
+static inline void stats_sample(CascadeStats *s, int depth) {
+  stats_step(s, depth);
+  s->depths[depth]++;
+  s->samples++;
+}
+
+/**
+   Writes the statistics of epidemic id: one line {depth F d samples} per
+   depth reached, then one line {step F t providers infections contacts
+   links R repeat_ratio o_0 o_1 ...} per time step, where R is the number
+   of infections per provider, repeat_ratio the share of the cascade links
+   into nodes already infected at the step, and o_k the number of providers
+   that infected k nodes (the last bin holds STATS_OFFSPRING-1 and more)
+*/
+void stats_write(CascadeStats *s, int id, FILE *output) {
+  int t, k, bins;
+  StepStats *step;
+  for (t = 0; t <= s->num_steps; t++)
+    if (s->depths[t])
+      fprintf(output, "depth %d %d %ld\n", id, t, s->depths[t]);
+  for (t = 1; t <= s->num_steps && s->steps[t-1].providers > 0; t++) {
+    step = s->steps + t - 1;
+    fprintf(output, "step %d %d %ld %ld %ld %ld %.4f %.4f", id, t, step->providers, step->infections,
+	    step->contacts, step->links, (double)step->infections / step->providers,
+	    step->links ? (double)(step->links - step->infections) / step->links : 0.0);
+    for (bins = STATS_OFFSPRING; bins > 1 && step->offspring[bins-1] == 0; bins--)
+      ;
+    for (k = 0; k < bins; k++)
+      fprintf(output, " %ld", step->offspring[k]);
+    fputc('\n', output);
+  }
+}
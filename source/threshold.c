@@ -0,0 +1,159 @@
+/*
+  Epidemic threshold finder: stochastic bisection of the spreading
+  probability p at which an epidemic becomes a giant outbreak (reaches a
+  given size) with probability 1/2. Each candidate p draws batches of
+  samples until the Wilson confidence interval of its outbreak frequency
+  leaves 1/2, which decides the side of the bracket to keep.
+
+  Sample k of every candidate uses the same arc coins: since a coin that
+  comes up at some p also comes up at any larger one, the outcomes of
+  nearby candidates are coupled and their differences are not drowned in
+  sampling noise.
+*/
+
+#define THRESHOLD_MIN_BATCH 64       // samples of the first batch of a candidate
+#define THRESHOLD_MAX_SAMPLES 10000  // default max samples per candidate
+#define THRESHOLD_Z 2.576            // 99% intervals for the bisection decisions
+
+typedef struct _ThresholdSearch {
+  int giant;              // outbreak size
+  double tolerance;       // width of the final bracket
+  int max_samples;        // max samples per candidate
+  long simulations;       // samples drawn so far
+} ThresholdSearch;
+
+/**
+   Wilson score interval of a frequency of x successes out of n trials
+*/
+static void wilson_interval(long x, long n, double z, double *low, double *high) {
+  double center = (x + z*z/2) / (n + z*z);
+  double half = z / (n + z*z) * sqrt((double)x * (n - x) / n + z*z/4);
+  *low = center - half;
+  *high = center + half;
+}
+
+/**
+   Runs samples first, ..., last-1 of epidemic j at probability p on the
+   thread workspaces; returns the number of giant outbreaks
+*/
+static long threshold_batch(Epidemic **workspace, InitialCondition *ic, int j, double p,
+			    int first, int last, int giant, uint64_t seed) {
+  long outbreaks = 0;
+  int k;
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:outbreaks)
+  for (k = first; k < last; k++) {
+    Epidemic *epidemic = workspace[omp_get_thread_num()];
+    epidemic_set_p(epidemic, p);
+    epidemic_restart(epidemic, ic, rng_hash(seed, ((uint64_t)j << 32) | (uint32_t)(k+1)));
+    while (epidemic->num_infected < giant && epidemic_step(epidemic))
+      ;
+    outbreaks += epidemic->num_infected >= giant;
+  }
+  return outbreaks;
+}
+
+/**
+   Samples epidemic j at probability p until the confidence interval of its
+   outbreak frequency excludes 1/2, or max_samples. Returns -1 (resp. 1) if
+   outbreaks are less (resp. more) likely than not, 0 if undecided.
+*/
+static int threshold_test(Epidemic **workspace, InitialCondition *ic, int j, double p,
+			  ThresholdSearch *ts, uint64_t seed, double *low, double *high) {
+  int n = 0, batch;
+  long outbreaks = 0;
+  do {
+    batch = n > THRESHOLD_MIN_BATCH ? n : THRESHOLD_MIN_BATCH;
+    if (n + batch > ts->max_samples)
+      batch = ts->max_samples - n;
+    outbreaks += threshold_batch(workspace, ic, j, p, n, n + batch, ts->giant, seed);
+    n += batch;
+    wilson_interval(outbreaks, n, THRESHOLD_Z, low, high);
+  } while (*low <= 0.5 && *high >= 0.5 && n < ts->max_samples);
+  ts->simulations += n;
+  fprintf(stderr, "  p = %.6f: %ld / %d giant outbreaks, frequency in [%.3f, %.3f]\n",
+	  p, outbreaks, n, *low, *high);
+  fflush(stderr);
+  return *high < 0.5 ? -1 : (*low > 0.5 ? 1 : 0);
+}
+
+/**
+   Bisects [*low, *high] down to ts->tolerance, *low being decided below the
+   threshold. Candidates p are decided by test(p) if possible; undecided ones
+   go to the side given by 'undecided' (the side of their outbreak frequency
+   if 0). Returns the number of candidates.
+*/
+static int threshold_bisect(Epidemic **workspace, InitialCondition *ic, int j, ThresholdSearch *ts,
+			    uint64_t seed, double *low, double *high, int undecided,
+			    double *decided_low, double *decided_high) {
+  int candidates = 0, side;
+  double p, flow, fhigh;
+  while (*high - *low > ts->tolerance) {
+    p = (*low + *high) / 2;
+    candidates++;
+    side = threshold_test(workspace, ic, j, p, ts, seed, &flow, &fhigh);
+    if (side < 0 && p > *decided_low)
+      *decided_low = p;
+    if (side > 0 && p < *decided_high)
+      *decided_high = p;
+    if (side == 0)
+      side = undecided ? undecided : (flow + fhigh < 1 ? -1 : 1);
+    if (side < 0)
+      *low = p;
+    else
+      *high = p;
+  }
+  return candidates;
+}
+
+/**
+   Finds, for each initial condition, the spreading probability at which its
+   epidemic reaches ts->giant nodes with probability 1/2, reusing one
+   workspace per thread for all candidates. Candidates within sampling noise
+   of the threshold are bisected by their outbreak frequency; the confidence
+   interval then extends to the nearest decided candidates on both sides,
+   which are themselves bisected down to the tolerance.
+*/
+void threshold_find(graph *g, InitialCondition *ic, int epidemics, ThresholdSearch *ts,
+		    uint64_t seed, FILE *output) {
+  int j, k, candidates, threads = omp_get_max_threads();
+  double low, high, top, decided_low, decided_high, estimate, start;
+  Epidemic **workspace = (Epidemic **) malloc(threads * sizeof(Epidemic *));
+  assert(workspace != NULL);
+  for (k = 0; k < threads; k++)
+    workspace[k] = epidemic_new(1, g, ic, NULL, seed);
+
+  for (j = 0; j < epidemics; j++) {
+    start = omp_get_wtime();
+    ts->simulations = 0;
+    fprintf(stderr, "%s- searching the threshold of epidemic %d (giant outbreak: %d nodes)...\n",
+	    tstamp(), ic[j].id, ts->giant);
+    fflush(stderr);
+    low = decided_low = 0;
+    high = decided_high = 1;
+    candidates = threshold_bisect(workspace, ic+j, j, ts, seed, &low, &high, 0,
+				  &decided_low, &decided_high);
+    estimate = (low + high) / 2;
+    top = high;
+    // edges of the confidence interval: the undecided candidates are inside
+    if (low > decided_low) {
+      high = low;
+      low = decided_low;
+      candidates += threshold_bisect(workspace, ic+j, j, ts, seed, &low, &high, 1,
+				     &decided_low, &decided_high);
+    }
+    if (top < decided_high) {
+      low = top;
+      high = decided_high;
+      candidates += threshold_bisect(workspace, ic+j, j, ts, seed, &low, &high, -1,
+				     &decided_low, &decided_high);
+    }
+    fprintf(output, "Epidemic %d: threshold p = %.6g in [%.6g, %.6g] (99%% decisions) "
+	    "after %d candidates and %ld simulations in %.2fs\n", ic[j].id, estimate,
+	    decided_low, decided_high, candidates, ts->simulations, omp_get_wtime() - start);
+    fflush(output);
+  }
+
+  for (k = 0; k < threads; k++)
+    epidemic_destroy(workspace[k]);
+  free(workspace);
+}
@@ -0,0 +1,432 @@
+/*
+  Spreading trace: events {t P C} of one epidemic buffered until it ends,
+  so that they can be written together, sorted by time, provider and client.
+  A buffer holds at most 'budget' events in memory; beyond that, it spills
+  them as a sorted run to an (unlinked) temporary file, and the runs are
+  merged back when the buffer is committed to the trace.
+
+  The trace may be written with a sidecar index: one entry per block of
+  consecutive lines with the same epidemic id F and time step t, giving
+  the block's byte offset and number of lines (see scascade-query).
+
+  A filter restricts the trace to some time steps, epidemics, and events
+  whose provider or client is in a node set; it is applied by the writer,
+  before any event is buffered or formatted.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+
+#define TRACE_MIN_READ 4096 // min events read at once from a run, bounding the runs merged at once
+#define TRACE_INDEX_MAGIC "SCIDX01\n"
+
+typedef struct _Event {
+  int t;                  // time step
+  int provider;           // infecting node
+  int client;             // contacted node
+} Event;
+
+typedef struct _TraceIndexEntry {
+  int32_t id;             // epidemic id
+  int32_t t;              // time step
+  int64_t offset;         // byte offset of the block in the trace
+  int64_t count;          // number of lines of the block
+} TraceIndexEntry;
+
+typedef struct _TraceIndex {
+  FILE *output;           // index file
+  long offset;            // bytes written to the trace so far
+  TraceIndexEntry block;  // current block
+} TraceIndex;
+
+typedef struct _TraceBuffer {
+  long budget;            // max number of events held in memory
+  long size;              // events in memory
+  long capacity;          // events allocated
+  Event *events;          // events in memory
+  const char *tmp_dir;    // directory for spilled runs
+  int fd;                 // spill file, -1 if none yet
+  int runs;               // number of spilled runs
+  long *run_start;        // first event of each run in the spill file
+} TraceBuffer;
+
+typedef struct _Range {
+  int first, last;
+} Range;
+
+typedef struct _TraceFilter {
+  int tmin, tmax;         // time steps kept
+  int num_ids;            // if non-zero, number of ranges of ...
+  Range *ids;             // ... the epidemic ids kept
+  uint64_t *nodes;        // if set, bitmap of the nodes kept ...
+  uint64_t provider;      // ... as providers (1) or not (0) ...
+  uint64_t client;        // ... and as clients
+} TraceFilter;
+
+typedef struct _TraceRun {
+  long next;              // next event to read from the spill file
+  long end;               // end of the run in the spill file
+  int pos, len;           // position and length of the read events
+  Event *events;          // read events
+} TraceRun;
+
+static int event_compare(const void *a, const void *b) {
+  const Event *x = (const Event *) a, *y = (const Event *) b;
+  if (x->t != y->t)
+    return x->t < y->t ? -1 : 1;
+  if (x->provider != y->provider)
+    return x->provider < y->provider ? -1 : 1;
+  return (x->client > y->client) - (x->client < y->client);
+}
+
+/**
+   Parses a list of ids and id ranges, e.g. "0,3,10-20"
+*/
+int ranges_parse(char *list, Range **ranges) {
+  int n = 0;
+  char *item, *save = NULL;
+  *ranges = NULL;
+  for (item = strtok_r(list, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    *ranges = (Range *) realloc(*ranges, (n+1) * sizeof(Range));
+    assert(*ranges != NULL);
+    if (sscanf(item, "%d-%d", &(*ranges)[n].first, &(*ranges)[n].last) != 2)
+      (*ranges)[n].last = (*ranges)[n].first = atoi(item);
+    n++;
+  }
+  return n;
+}
+
+static inline int ranges_contain(Range *ranges, int n, int id) {
+  int k;
+  if (n == 0)
+    return 1;
+  for (k = 0; k < n; k++)
+    if (ranges[k].first <= id && id <= ranges[k].last)
+      return 1;
+  return 0;
+}
+
+/**
+   Parses a time range "T", "T1:T2", "T1:" or ":T2"
+*/
+void time_range_parse(char *range, int *tmin, int *tmax) {
+  char *colon = strchr(range, ':');
+  *tmin = INT_MIN;
+  *tmax = INT_MAX;
+  if (colon == NULL)
+    *tmin = *tmax = atoi(range);
+  else {
+    if (range[0] != ':')
+      *tmin = atoi(range);
+    if (colon[1] != '\0')
+      *tmax = atoi(colon+1);
+  }
+}
+
+void trace_filter_init(TraceFilter *f) {
+  memset(f, 0, sizeof(TraceFilter));
+  f->tmin = INT_MIN;
+  f->tmax = INT_MAX;
+  f->provider = f->client = 1;
+}
+
+void trace_filter_clean(TraceFilter *f) {
+  free(f->ids);
+  free(f->nodes);
+  f->ids = NULL;
+  f->nodes = NULL;
+}
+
+/**
+   Reads the node set of the filter from a list of node ids in 0, ..., n-1
+*/
+void trace_filter_load_nodes(TraceFilter *f, FILE *input, int n) {
+  int u;
+  assert(input != NULL);
+  free(f->nodes);
+  f->nodes = (uint64_t *) calloc(n / 64 + 1, sizeof(uint64_t));
+  assert(f->nodes != NULL);
+  while (fscanf(input, "%d", &u) == 1) {
+    if (u < 0 || u >= n)
+      report_error("trace_filter_load_nodes: node id out of range");
+    f->nodes[u >> 6] |= 1ULL << (u & 63);
+  }
+}
+
+/**
+   Renames the nodes of the filter: node u is now perm[u]
+*/
+void trace_filter_relabel(TraceFilter *f, int *perm, int n) {
+  uint64_t *nodes;
+  int u;
+  if (f->nodes == NULL)
+    return;
+  nodes = (uint64_t *) calloc(n / 64 + 1, sizeof(uint64_t));
+  assert(nodes != NULL);
+  for (u = 0; u < n; u++)
+    if ((f->nodes[u >> 6] >> (u & 63)) & 1)
+      nodes[perm[u] >> 6] |= 1ULL << (perm[u] & 63);
+  free(f->nodes);
+  f->nodes = nodes;
+}
+
+static inline int trace_filter_time(TraceFilter *f, int t) {
+  return f->tmin <= t && t <= f->tmax;
+}
+
+static inline int trace_filter_epidemic(TraceFilter *f, int id) {
+  return ranges_contain(f->ids, f->num_ids, id);
+}
+
+/**
+   Whether an event from provider u to client v passes the node set, without
+   branching on the set
+*/
+static inline int trace_filter_nodes(TraceFilter *f, int u, int v) {
+  return !f->nodes || (((f->nodes[u >> 6] >> (u & 63)) & f->provider) |
+		       ((f->nodes[v >> 6] >> (v & 63)) & f->client));
+}
+
+TraceBuffer *trace_buffer_new(long budget, const char *tmp_dir) {
+  TraceBuffer *b = (TraceBuffer *) calloc(1, sizeof(TraceBuffer));
+  assert(b != NULL);
+  assert(budget > 0);
+  b->budget = budget;
+  b->tmp_dir = tmp_dir;
+  b->fd = -1;
+  return b;
+}
+
+void trace_buffer_destroy(TraceBuffer *b) {
+  assert(b != NULL);
+  if (b->fd >= 0)
+    close(b->fd);
+  free(b->run_start);
+  free(b->events);
+  free(b);
+}
+
+/**
+   Writes the events in memory as a sorted run at the end of the spill file
+*/
+static void trace_buffer_spill(TraceBuffer *b) {
+  char path[4096];
+  size_t bytes = b->size * sizeof(Event);
+  if (b->fd < 0) {
+    snprintf(path, sizeof(path), "%s/scascade-XXXXXX", b->tmp_dir);
+    b->fd = mkstemp(path);
+    if (b->fd < 0)
+      report_error("trace_buffer_spill: cannot create a file in the tmp dir");
+    unlink(path);
+  }
+  qsort(b->events, b->size, sizeof(Event), event_compare);
+  b->run_start = (long *) realloc(b->run_start, (b->runs + 2) * sizeof(long));
+  assert(b->run_start != NULL);
+  if (b->runs == 0)
+    b->run_start[0] = 0;
+  if (pwrite(b->fd, b->events, bytes, b->run_start[b->runs] * sizeof(Event)) != (ssize_t) bytes)
+    report_error("trace_buffer_spill: write error");
+  b->run_start[b->runs+1] = b->run_start[b->runs] + b->size;
+  b->runs++;
+  b->size = 0;
+}
+
+static inline void trace_buffer_add(TraceBuffer *b, int t, int u, int v) {
+  if (b->size == b->capacity) {
+    if (b->size == b->budget)
+      trace_buffer_spill(b);
+    else {
+      b->capacity = b->capacity ? 2*b->capacity : 1024;
+      if (b->capacity > b->budget)
+	b->capacity = b->budget;
+      b->events = (Event *) realloc(b->events, b->capacity * sizeof(Event));
+      assert(b->events != NULL);
+    }
+  }
+  b->events[b->size].t = t;
+  b->events[b->size].provider = u;
+  b->events[b->size++].client = v;
+}
+
+TraceIndex *trace_index_new(const char *path) {
+  TraceIndex *index = (TraceIndex *) calloc(1, sizeof(TraceIndex));
+  assert(index != NULL);
+  index->output = fopen(path, "wb");
+  if (index->output == NULL)
+    report_error("trace_index_new: cannot open the index file");
+  fwrite(TRACE_INDEX_MAGIC, 1, 8, index->output);
+  return index;
+}
+
+/**
+   Writes the last block and closes the index
+*/
+void trace_index_close(TraceIndex *index) {
+  assert(index != NULL);
+  if (index->block.count)
+    fwrite(&index->block, sizeof(TraceIndexEntry), 1, index->output);
+  fclose(index->output);
+  free(index);
+}
+
+/**
+   Accounts for a line of 'bytes' bytes of epidemic id at time t, written
+   at the end of the trace
+*/
+static inline void trace_index_add(TraceIndex *index, int id, int t, int bytes) {
+  if (index->block.count == 0 || index->block.id != id || index->block.t != t) {
+    if (index->block.count)
+      fwrite(&index->block, sizeof(TraceIndexEntry), 1, index->output);
+    index->block.id = id;
+    index->block.t = t;
+    index->block.offset = index->offset;
+    index->block.count = 0;
+  }
+  index->block.count++;
+  index->offset += bytes;
+}
+
+/**
+   Prints a trace line "t P C F", accounting for it in the index if any;
+   with an index, callers must serialize the calls
+*/
+static inline void trace_print(FILE *output, TraceIndex *index, int t, int u, int v, int id) {
+  int bytes = fprintf(output, "%d %d %d %d\n", t, u, v, id);
+  if (index)
+    trace_index_add(index, id, t, bytes);
+}
+
+static inline void trace_write(FILE *output, TraceIndex *index, Event *e, int id) {
+  trace_print(output, index, e->t, e->provider, e->client, id);
+}
+
+/**
+   Refills the read events of a run; returns 0 when the run is exhausted
+*/
+static int trace_run_fill(TraceBuffer *b, TraceRun *r, int max) {
+  long n = r->end - r->next < max ? r->end - r->next : max;
+  if (n <= 0)
+    return 0;
+  if (pread(b->fd, r->events, n * sizeof(Event), r->next * sizeof(Event)) != (ssize_t)(n * sizeof(Event)))
+    report_error("trace_run_fill: read error");
+  r->next += n;
+  r->pos = 0;
+  r->len = n;
+  return 1;
+}
+
+/**
+   Merges the runs of the spill file from start[0] to start[count], run r
+   spanning start[r] to start[r+1], with a binary heap of their smallest
+   events. Each run is read by pieces of read_size events into the memory
+   of the buffer. The events are written to output as lines "t P C F" with
+   F = id if at < 0, else to the spill file from event at, through the
+   piece of memory after those of the runs.
+*/
+static void trace_runs_merge(TraceBuffer *b, long *start, int count, long read_size, long at,
+			     FILE *output, TraceIndex *index, int id) {
+  TraceRun *runs = (TraceRun *) calloc(count, sizeof(TraceRun));
+  int *heap = (int *) malloc(count * sizeof(int));
+  Event *merged = b->events + count * read_size;
+  int k, r, child, top;
+  long len = 0;
+  assert(runs != NULL && heap != NULL);
+  assert(read_size > 0 && (count + (at >= 0)) * read_size <= b->capacity);
+
+  for (r = k = 0; r < count; r++) {
+    runs[r].next = start[r];
+    runs[r].end = start[r+1];
+    runs[r].events = b->events + r * read_size;
+    if (!trace_run_fill(b, runs+r, read_size))
+      continue;
+    for (child = k++; child > 0 && event_compare(runs[r].events, runs[heap[(child-1)/2]].events + runs[heap[(child-1)/2]].pos) < 0; child = (child-1)/2)
+      heap[child] = heap[(child-1)/2];
+    heap[child] = r;
+  }
+  while (k > 0) {
+    r = heap[0];
+    if (at < 0)
+      trace_write(output, index, runs[r].events + runs[r].pos, id);
+    else {
+      merged[len++] = runs[r].events[runs[r].pos];
+      if (len == read_size) {
+	if (pwrite(b->fd, merged, len * sizeof(Event), at * sizeof(Event)) != (ssize_t)(len * sizeof(Event)))
+	  report_error("trace_runs_merge: write error");
+	at += len;
+	len = 0;
+      }
+    }
+    if (++runs[r].pos == runs[r].len && !trace_run_fill(b, runs+r, read_size))
+      r = heap[--k]; // run exhausted: sift down the last one instead
+    for (top = 0; (child = 2*top+1) < k; top = child) {
+      if (child+1 < k && event_compare(runs[heap[child+1]].events + runs[heap[child+1]].pos,
+				       runs[heap[child]].events + runs[heap[child]].pos) < 0)
+	child++;
+      if (event_compare(runs[heap[child]].events + runs[heap[child]].pos,
+			runs[r].events + runs[r].pos) >= 0)
+	break;
+      heap[top] = heap[child];
+    }
+    heap[top] = r;
+  }
+  if (len && pwrite(b->fd, merged, len * sizeof(Event), at * sizeof(Event)) != (ssize_t)(len * sizeof(Event)))
+    report_error("trace_runs_merge: write error");
+  free(runs);
+  free(heap);
+}
+
+/**
+   Writes all buffered events to output in (t, P, C) order, as lines
+   "t P C F" with F = id, and empties the buffer. If runs were spilled,
+   the events in memory are spilled too and the runs are merged in the
+   memory of the buffer, at most budget / TRACE_MIN_READ - 1 at a time:
+   while there are more, groups of runs are merged into longer runs of
+   the spill file, written alternately after and over the runs they
+   replace, so that the memory used stays within the budget whatever the
+   number of events.
+*/
+void trace_buffer_commit(TraceBuffer *b, FILE *output, TraceIndex *index, int id) {
+  int r, count, merged, fan_in;
+  long i, at, *start;
+
+  if (b->runs == 0) {
+    qsort(b->events, b->size, sizeof(Event), event_compare);
+    for (i = 0; i < b->size; i++)
+      trace_write(output, index, b->events+i, id);
+    b->size = 0;
+    return;
+  }
+  if (b->size)
+    trace_buffer_spill(b);
+  assert(b->capacity == b->budget); // the buffer was full when it spilled
+
+  fan_in = b->budget / TRACE_MIN_READ - 1;
+  if (fan_in < 2)
+    fan_in = 2;
+  while (b->runs > fan_in) {
+    // the runs fill [0, N) or [N, 2N) of the spill file, N events: merge into the other half
+    at = b->run_start[0] == 0 ? b->run_start[b->runs] : 0;
+    merged = (b->runs + fan_in - 1) / fan_in;
+    start = (long *) malloc((merged + 2) * sizeof(long));
+    assert(start != NULL);
+    start[0] = at;
+    for (r = i = 0; r < b->runs; r += count, i++) {
+      count = b->runs - r < fan_in ? b->runs - r : fan_in;
+      trace_runs_merge(b, b->run_start + r, count, b->budget / (count + 1), start[i], NULL, NULL, id);
+      start[i+1] = start[i] + b->run_start[r+count] - b->run_start[r];
+    }
+    free(b->run_start);
+    b->run_start = start;
+    b->runs = merged;
+  }
+  trace_runs_merge(b, b->run_start, b->runs, b->budget / b->runs, -1, output, index, id);
+
+  if (ftruncate(b->fd, 0) != 0)
+    report_error("trace_buffer_commit: cannot truncate the spill file");
+  b->runs = 0;
+}
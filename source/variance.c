@@ -0,0 +1,122 @@
+/*
+  Estimates of the final size of an epidemic over its sample epidemics,
+  for the variance reduction schemes: the standard error of the mean is
+  computed from the groups of samples that share a seed (see arc_sample),
+  which are independent of each other, and compared with the standard
+  error that as many independent samples would have, estimated from the
+  spread of the sizes, which gives the variance reduction achieved.
+
+  With a control variate, the samples are independent, and the size of each
+  one is corrected by its number of contacts from the initial nodes at the
+  first time step, whose mean is known exactly: p times the degrees of the
+  initial nodes, the first generation of the branching process. The
+  correction factor is the regression slope of the sizes on the contacts.
+*/
+
+typedef enum _VarianceScheme {VarianceNone, VarianceAntithetic, VarianceLattice, VarianceControl} VarianceScheme;
+
+typedef struct _SizeEstimate {
+  int samples;            // samples counted
+  int group;              // samples per group sharing a seed
+  double *size;           // final size of each sample
+  double *control;        // control variate of each sample (if set)
+  double control_mean;    // exact mean of the control variate
+} SizeEstimate;
+
+/**
+   Arc variates of a variance reduction scheme
+*/
+static inline Variates variance_variates(VarianceScheme scheme) {
+  return scheme == VarianceAntithetic ? VariatesAntithetic :
+    (scheme == VarianceLattice ? VariatesLattice : VariatesIndependent);
+}
+
+SizeEstimate *estimate_new(int samples, int group, int control) {
+  SizeEstimate *e = (SizeEstimate *) malloc(sizeof(SizeEstimate));
+  assert(e != NULL && samples > 0 && group > 0);
+  e->samples = 0;
+  e->group = group;
+  e->size = (double *) malloc(samples * sizeof(double));
+  e->control = control ? (double *) malloc(samples * sizeof(double)) : NULL;
+  e->control_mean = 0;
+  assert(e->size != NULL && (!control || e->control != NULL));
+  return e;
+}
+
+void estimate_destroy(SizeEstimate *e) {
+  free(e->size);
+  free(e->control);
+  free(e);
+}
+
+/**
+   Counts the next sample, of the given final size and control variate
+*/
+static inline void estimate_add(SizeEstimate *e, double size, double control) {
+  if (e->control)
+    e->control[e->samples] = control;
+  e->size[e->samples++] = size;
+}
+
+/**
+   Number of contacts of the initial nodes of ic at the first time step of
+   an epidemic, the control variate of its final size; its mean is set in
+   *mean
+*/
+double estimate_first_contacts(Epidemic *epidemic, InitialCondition *ic, double *mean) {
+  graph *g = epidemic->g;
+  long degrees = 0, contacts = 0;
+  int k, i, u;
+  for (k = 0; k < ic->num_infected; k++) {
+    u = ic->infected[k];
+    degrees += g->degrees[u];
+    for (i = 0; i < g->degrees[u]; i++)
+      contacts += arc_coin(epidemic->seed, u, i, epidemic->threshold, &epidemic->variates);
+  }
+  *mean = degrees * (epidemic->threshold / 9007199254740992.0);
+  return contacts;
+}
+
+/**
+   Writes the estimate of the mean final size of epidemic id, with its
+   standard error, and the variance reduction over independent samples,
+   which is returned (0 if it cannot be estimated)
+*/
+double estimate_write(SizeEstimate *e, int id, const char *scheme, FILE *output) {
+  int n = e->samples, i, k, groups = (n + e->group - 1) / e->group, size;
+  double mean = 0, cmean = 0, var = 0, cvar = 0, cov = 0, slope = 0, error = 0, group_mean, reduction;
+  for (k = 0; k < n; k++)
+    mean += e->size[k] / n;
+  for (k = 0; k < n; k++)
+    var += (e->size[k] - mean) * (e->size[k] - mean) / (n > 1 ? n - 1 : 1);
+  if (e->control) {
+    // regression on the control variate
+    for (k = 0; k < n; k++)
+      cmean += e->control[k] / n;
+    for (k = 0; k < n; k++) {
+      cvar += (e->control[k] - cmean) * (e->control[k] - cmean);
+      cov += (e->control[k] - cmean) * (e->size[k] - mean);
+    }
+    slope = cvar > 0 ? cov / cvar : 0;
+    for (k = 0; k < n; k++)
+      error += pow(e->size[k] - mean - slope * (e->control[k] - cmean), 2) / (n > 2 ? n - 2 : 1) / n;
+    mean -= slope * (cmean - e->control_mean);
+  } else if (groups > 1) {
+    // spread of the group means, weighed by their sizes
+    for (k = 0; k < groups; k++) {
+      size = (k+1) * e->group < n ? e->group : n - k * e->group;
+      group_mean = 0;
+      for (i = k * e->group; i < k * e->group + size; i++)
+	group_mean += e->size[i] / size;
+      error += pow((double)size / n * (group_mean - mean), 2);
+    }
+    error *= (double)groups / (groups - 1);
+  }
+  reduction = error > 0 ? var / n / error : 0;
+  fprintf(output, "Epidemic %d: mean size %.2f +- %.2f over %d samples (%s", id, mean, sqrt(error), n, scheme);
+  if (reduction > 0)
+    fprintf(output, ", variance reduction %.2fx)\n", reduction);
+  else
+    fprintf(output, ", variance reduction unknown)\n");
+  return reduction;
+}